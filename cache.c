@@ -24,148 +24,1139 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+#include <sys/param.h>
+#include <sys/time.h>
+#include <pthread.h>
+
 #include "cache.h"
+#include "cache_file.h"
+
+enum CACHE_STMT {
+    STMT_CACHED,
+    STMT_DELETE,
+    STMT_READ,
+    STMT_WRITE,
+    STMT_LOOKUP_CLEAR,
+    STMT_LOOKUP_ADD,
+    STMT_LOOKUP_COUNT,
+    STMT_LOOKUP_DELETE,
+    STMT_FINGERPRINT_GET,
+    STMT_FINGERPRINT_SET,
+    STMT_TOUCH,
+    STMT_EVICT_SIZE,
+    STMT_EVICT_DELETE,
+    STMT_INFO_GET,
+    STMT_LEVEL_READ,
+    STMT_LEVEL_WRITE,
+    N_CACHE_STMTS
+};
+
+static const char *stmt_queries[N_CACHE_STMTS] = {
+    [STMT_CACHED] = "SELECT 1 FROM wave WHERE path = ?",
+    [STMT_DELETE] = "DELETE FROM wave WHERE path = ?",
+    [STMT_READ] = "SELECT channels, compression, data FROM wave WHERE path = ?",
+    // replacing doesn't fire the delete trigger, levels are kept
+    [STMT_WRITE] = "INSERT OR REPLACE INTO wave (path, channels, compression, data, size, mtime, content_hash, accessed, samples, samplerate, duration) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+    [STMT_LOOKUP_CLEAR] = "DELETE FROM temp.lookup",
+    [STMT_LOOKUP_ADD] = "INSERT OR IGNORE INTO temp.lookup (path) VALUES (?)",
+    [STMT_LOOKUP_COUNT] = "SELECT COUNT(*) FROM wave WHERE path IN (SELECT path FROM temp.lookup)",
+    [STMT_LOOKUP_DELETE] = "DELETE FROM wave WHERE path IN (SELECT path FROM temp.lookup)",
+    [STMT_FINGERPRINT_GET] = "SELECT size, mtime, content_hash FROM wave WHERE path = ?",
+    [STMT_FINGERPRINT_SET] = "UPDATE wave SET size = ?2, mtime = ?3, content_hash = ?4 WHERE path = ?1",
+    [STMT_TOUCH] = "UPDATE wave SET accessed = ?2 WHERE path = ?1",
+    [STMT_EVICT_SIZE] = "SELECT (SELECT COALESCE(SUM(LENGTH(data)), 0) FROM wave) + (SELECT COALESCE(SUM(LENGTH(data)), 0) FROM wave_level)",
+    // rows from before access times were recorded sort first
+    [STMT_EVICT_DELETE] = "DELETE FROM wave WHERE path IN (SELECT path FROM wave ORDER BY accessed ASC LIMIT ?)",
+    [STMT_INFO_GET] = "SELECT samples, samplerate, duration FROM wave WHERE path = ?",
+    [STMT_LEVEL_READ] = "SELECT channels, compression, data, samples, samplerate, duration FROM wave_level WHERE path = ?1 AND samples >= ?2 ORDER BY samples ASC LIMIT 1",
+    [STMT_LEVEL_WRITE] = "INSERT OR REPLACE INTO wave_level (path, samples, samplerate, duration, channels, compression, data) VALUES (?, ?, ?, ?, ?, ?, ?)",
+};
+
+// Schema version kept in PRAGMA user_version, see waveform_db_migrate
+#define WAVE_DB_VERSION (3)
+
+// collect writes for up to this long to commit them together
+#define WRITER_DELAY_MSEC (500)
+#define WRITER_BATCH_SIZE (32)
 
+typedef struct cache_write_s
+{
+    char *fname;
+    // raw shorts, encoded on the writer thread
+    short *data;
+    int data_len;
+    int channels;
+    int compression;
+    int has_fingerprint;
+    waveform_fingerprint_t fingerprint;
+    waveform_db_info_t info;
+    // deleted while its batch was being written
+    int cancelled;
+    struct cache_write_s *next;
+} cache_write_t;
+
+static int backend = WAVE_CACHE_SQLITE;
 static sqlite3 *db;
+// prepared once per connection, use them with db_mutex held
+static sqlite3_stmt *stmts[N_CACHE_STMTS];
+// guards db and stmts, sqlite only locks connections itself when it runs
+// in serialized mode. Recursive, batches write through waveform_db_store.
+static pthread_mutex_t db_mutex;
+static pthread_once_t db_mutex_once = PTHREAD_ONCE_INIT;
+
+static pthread_t writer_thread;
+static int writer_running = 0;
+static int writer_stopping = 0;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+// queued writes and the batch currently being written, both stay visible
+// to readers until they are committed
+static cache_write_t *writer_queue;
+static cache_write_t *writer_queue_tail;
+static int writer_queue_len = 0;
+static cache_write_t *writer_batch;
+
+static void
+waveform_db_finalize (void)
+{
+    for (int i = 0; i < N_CACHE_STMTS; i++) {
+        if (stmts[i]) {
+            sqlite3_finalize (stmts[i]);
+            stmts[i] = NULL;
+        }
+    }
+}
+
+// Returns the statement reset and bound to fname or NULL on failure.
+static sqlite3_stmt *
+waveform_db_stmt_begin (int id, char const *fname)
+{
+    sqlite3_stmt *p = stmts[id];
+    if (!p) {
+        return NULL;
+    }
+    int rc = sqlite3_bind_text (p, 1, fname, -1, SQLITE_TRANSIENT);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "bind_fname: SQL error: %d\n", rc);
+        return NULL;
+    }
+    return p;
+}
+
+static void
+waveform_db_stmt_end (sqlite3_stmt *p)
+{
+    sqlite3_reset (p);
+    sqlite3_clear_bindings (p);
+}
+
+#define LOG8_MAX_VALUE (1000)
+#define LOG8_STEPS (127)
+
+// Streams of the same channel and value (max, min or rms) change slowly
+// from one slot to the next, so their deltas mostly fit into one byte.
+static size_t
+waveform_encode_delta (const short *data, int n, int channels, unsigned char *out)
+{
+    const int stride = channels * 3;
+    unsigned char *p = out;
+    for (int i = 0; i < n; i++) {
+        const int prev = i >= stride ? data[i - stride] : 0;
+        const int delta = data[i] - prev;
+        unsigned int zz = ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31);
+        while (zz >= 0x80) {
+            *p++ = (zz & 0x7f) | 0x80;
+            zz >>= 7;
+        }
+        *p++ = zz;
+    }
+    return p - out;
+}
+
+static int
+waveform_decode_delta (const unsigned char *in, size_t in_len, int channels, short *data, int max_n)
+{
+    const int stride = channels * 3;
+    size_t pos = 0;
+    int n = 0;
+    while (pos < in_len && n < max_n) {
+        unsigned int zz = 0;
+        int shift = 0;
+        while (pos < in_len && shift < 32) {
+            const unsigned char b = in[pos++];
+            zz |= (unsigned int)(b & 0x7f) << shift;
+            shift += 7;
+            if (!(b & 0x80)) {
+                break;
+            }
+        }
+        const int delta = (int)(zz >> 1) ^ -(int)(zz & 1);
+        const int prev = n >= stride ? data[n - stride] : 0;
+        data[n] = prev + delta;
+        n++;
+    }
+    return n;
+}
+
+// Sign bit plus 7 bit log scaled magnitude, which keeps quiet passages
+// distinguishable while loud ones lose a few percent of precision.
+static size_t
+waveform_encode_log8 (const short *data, int n, unsigned char *out)
+{
+    const double scale = LOG8_STEPS / log (1 + LOG8_MAX_VALUE);
+    for (int i = 0; i < n; i++) {
+        const int mag = MIN (abs (data[i]), LOG8_MAX_VALUE);
+        out[i] = (data[i] < 0 ? 0x80 : 0) | (unsigned char)lrint (log (1 + mag) * scale);
+    }
+    return n;
+}
+
+static int
+waveform_decode_log8 (const unsigned char *in, size_t in_len, short *data, int max_n)
+{
+    const double scale = log (1 + LOG8_MAX_VALUE) / LOG8_STEPS;
+    const int n = MIN (in_len, max_n);
+    for (int i = 0; i < n; i++) {
+        const short mag = lrint (exp ((in[i] & 0x7f) * scale) - 1);
+        data[i] = in[i] & 0x80 ? -mag : mag;
+    }
+    return n;
+}
+
+static void
+waveform_db_exec (const char *query)
+{
+    char *zErrMsg = 0;
+    int rc = sqlite3_exec(db, query, NULL, 0, &zErrMsg);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", zErrMsg);
+    }
+    sqlite3_free(zErrMsg);
+}
+
+// Encodes buffer according to *compression into a new allocation, updating
+// *buffer_len. Returns NULL for raw data (or on failure, then *compression is
+// -1).
+static unsigned char *
+waveform_db_encode (short *buffer, int *buffer_len, int channels, int *compression)
+{
+    const int n = *buffer_len / sizeof(short);
+    if (*compression != WAVE_COMPRESSION_DELTA && *compression != WAVE_COMPRESSION_LOG8) {
+        *compression = WAVE_COMPRESSION_NONE;
+        return NULL;
+    }
+    // a zigzagged 16 bit delta takes at most 3 varint bytes
+    unsigned char *encoded = malloc (n * 3);
+    if (!encoded) {
+        *compression = -1;
+        return NULL;
+    }
+    if (*compression == WAVE_COMPRESSION_DELTA) {
+        *buffer_len = waveform_encode_delta (buffer, n, channels, encoded);
+    }
+    else {
+        *buffer_len = waveform_encode_log8 (buffer, n, encoded);
+    }
+    return encoded;
+}
+
+static int
+waveform_db_decode (int compression, const void *data, int bytes, int channels, short *buffer, int buffer_len)
+{
+    if (!data || channels <= 0) {
+        return 0;
+    }
+    int n = 0;
+    switch (compression) {
+        case WAVE_COMPRESSION_DELTA:
+            n = waveform_decode_delta (data, bytes, channels, buffer, buffer_len);
+            break;
+        case WAVE_COMPRESSION_LOG8:
+            n = waveform_decode_log8 (data, bytes, buffer, buffer_len);
+            break;
+        case WAVE_COMPRESSION_NONE:
+            n = MIN (bytes / sizeof(short), buffer_len);
+            memcpy (buffer, data, n * sizeof(short));
+            break;
+        default:
+            fprintf(stderr, "read: unknown compression %d\n", compression);
+            break;
+    }
+    return n;
+}
+
+static int
+waveform_db_version (void)
+{
+    sqlite3_stmt *p = NULL;
+    if (sqlite3_prepare_v2 (db, "PRAGMA user_version", -1, &p, NULL) != SQLITE_OK) {
+        return 0;
+    }
+    const int version = sqlite3_step (p) == SQLITE_ROW ? sqlite3_column_int (p, 0) : 0;
+    sqlite3_finalize (p);
+    return version;
+}
+
+static int
+waveform_db_column_exists (const char *table, const char *column)
+{
+    char query[100] = "";
+    snprintf (query, sizeof (query), "PRAGMA table_info(%s)", table);
+    sqlite3_stmt *p = NULL;
+    if (sqlite3_prepare_v2 (db, query, -1, &p, NULL) != SQLITE_OK) {
+        return 0;
+    }
+    int exists = 0;
+    while (!exists && sqlite3_step (p) == SQLITE_ROW) {
+        const char *name = (const char *)sqlite3_column_text (p, 1);
+        exists = name && !strcmp (name, column);
+    }
+    sqlite3_finalize (p);
+    return exists;
+}
+
+static void
+waveform_db_add_column (const char *table, const char *column, const char *type)
+{
+    if (!waveform_db_column_exists (table, column)) {
+        char query[200] = "";
+        snprintf (query, sizeof (query), "ALTER TABLE %s ADD COLUMN %s %s", table, column, type);
+        waveform_db_exec (query);
+    }
+}
+
+// Brings the schema up to WAVE_DB_VERSION. Versions 1 and 2 weren't recorded,
+// so their columns are only added where they are missing.
+static void
+waveform_db_migrate (void)
+{
+    const int version = waveform_db_version ();
+    if (version >= WAVE_DB_VERSION) {
+        return;
+    }
+    waveform_db_exec ("BEGIN");
+    // 1: fingerprints
+    waveform_db_add_column ("wave", "size", "INTEGER");
+    waveform_db_add_column ("wave", "mtime", "INTEGER");
+    waveform_db_add_column ("wave", "content_hash", "INTEGER");
+    // 2: access times for eviction
+    waveform_db_add_column ("wave", "accessed", "INTEGER");
+    waveform_db_exec ("CREATE INDEX IF NOT EXISTS wave_accessed ON wave (accessed)");
+    // 3: analysis parameters and extra resolutions, rows of earlier versions
+    // keep NULL (unknown) parameters
+    waveform_db_add_column ("wave", "samples", "INTEGER");
+    waveform_db_add_column ("wave", "samplerate", "INTEGER");
+    waveform_db_add_column ("wave", "duration", "REAL");
+    waveform_db_exec ("CREATE TABLE IF NOT EXISTS wave_level ( path TEXT NOT NULL, samples INTEGER NOT NULL, samplerate INTEGER, duration REAL, channels INTEGER NOT NULL, compression INTEGER, data BLOB, PRIMARY KEY (path, samples))");
+    waveform_db_exec ("CREATE TRIGGER IF NOT EXISTS wave_level_delete AFTER DELETE ON wave BEGIN DELETE FROM wave_level WHERE path = OLD.path; END");
+
+    char query[100] = "";
+    snprintf (query, sizeof (query), "PRAGMA user_version = %d", WAVE_DB_VERSION);
+    waveform_db_exec (query);
+    waveform_db_exec ("COMMIT");
+}
+
+static void
+waveform_db_write_list_free (cache_write_t *list)
+{
+    while (list) {
+        cache_write_t *next = list->next;
+        free (list->fname);
+        free (list->data);
+        free (list);
+        list = next;
+    }
+}
+
+// Returns the newest pending write of fname. Call with writer_mutex held.
+static cache_write_t *
+waveform_db_pending_find (char const *fname)
+{
+    cache_write_t *found = NULL;
+    for (cache_write_t *q = writer_batch; q; q = q->next) {
+        if (!q->cancelled && !strcmp (q->fname, fname)) {
+            found = q;
+        }
+    }
+    for (cache_write_t *q = writer_queue; q; q = q->next) {
+        if (!strcmp (q->fname, fname)) {
+            found = q;
+        }
+    }
+    return found;
+}
+
+// Forgets pending writes of fname so a delete can't be undone by them.
+static void
+waveform_db_pending_drop (char const *fname)
+{
+    pthread_mutex_lock (&writer_mutex);
+    for (cache_write_t *q = writer_batch; q; q = q->next) {
+        if (!strcmp (q->fname, fname)) {
+            q->cancelled = 1;
+        }
+    }
+    cache_write_t *prev = NULL;
+    cache_write_t *q = writer_queue;
+    while (q) {
+        cache_write_t *next = q->next;
+        if (!strcmp (q->fname, fname)) {
+            if (prev) {
+                prev->next = next;
+            }
+            else {
+                writer_queue = next;
+            }
+            if (writer_queue_tail == q) {
+                writer_queue_tail = prev;
+            }
+            writer_queue_len--;
+            q->next = NULL;
+            waveform_db_write_list_free (q);
+        }
+        else {
+            prev = q;
+        }
+        q = next;
+    }
+    pthread_mutex_unlock (&writer_mutex);
+}
+
+static void
+waveform_db_store (char const *fname,
+                   short *buffer,
+                   int buffer_len,
+                   int channels,
+                   int compression,
+                   const waveform_fingerprint_t *fingerprint,
+                   const waveform_db_info_t *info);
+
+static void
+waveform_db_mutex_init (void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init (&attr);
+    pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init (&db_mutex, &attr);
+    pthread_mutexattr_destroy (&attr);
+}
+
+// Takes db_mutex if the sqlite backend is open, returns 0 without holding
+// it otherwise.
+static int
+waveform_db_lock (void)
+{
+    pthread_once (&db_mutex_once, waveform_db_mutex_init);
+    pthread_mutex_lock (&db_mutex);
+    if (!db) {
+        pthread_mutex_unlock (&db_mutex);
+        return 0;
+    }
+    return 1;
+}
+
+static void
+waveform_db_unlock (void)
+{
+    pthread_mutex_unlock (&db_mutex);
+}
+
+// Writes a batch, within a single transaction on the sqlite backend.
+static void
+waveform_db_store_batch (cache_write_t *batch)
+{
+    if (backend != WAVE_CACHE_FILE) {
+        if (!waveform_db_lock ()) {
+            return;
+        }
+        waveform_db_exec ("BEGIN");
+    }
+    for (cache_write_t *q = batch; q; q = q->next) {
+        pthread_mutex_lock (&writer_mutex);
+        const int cancelled = q->cancelled;
+        const int has_fingerprint = q->has_fingerprint;
+        const waveform_fingerprint_t fingerprint = q->fingerprint;
+        pthread_mutex_unlock (&writer_mutex);
+        if (!cancelled) {
+            waveform_db_store (q->fname, q->data, q->data_len, q->channels, q->compression, has_fingerprint ? &fingerprint : NULL, &q->info);
+        }
+    }
+    if (backend != WAVE_CACHE_FILE) {
+        waveform_db_exec ("COMMIT");
+        waveform_db_unlock ();
+    }
+}
+
+static void *
+waveform_db_writer_thread (void *ctx)
+{
+    pthread_mutex_lock (&writer_mutex);
+    for (;;) {
+        while (!writer_stopping && !writer_queue) {
+            pthread_cond_wait (&writer_cond, &writer_mutex);
+        }
+        if (!writer_queue) {
+            break;
+        }
+        // give a bulk scan the chance to add more writes to this commit
+        struct timeval now;
+        gettimeofday (&now, NULL);
+        struct timespec deadline;
+        deadline.tv_sec = now.tv_sec + WRITER_DELAY_MSEC / 1000;
+        deadline.tv_nsec = now.tv_usec * 1000 + (WRITER_DELAY_MSEC % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!writer_stopping && writer_queue_len < WRITER_BATCH_SIZE) {
+            if (pthread_cond_timedwait (&writer_cond, &writer_mutex, &deadline)) {
+                break;
+            }
+        }
+
+        writer_batch = writer_queue;
+        writer_queue = writer_queue_tail = NULL;
+        writer_queue_len = 0;
+        pthread_mutex_unlock (&writer_mutex);
+
+        waveform_db_store_batch (writer_batch);
+
+        pthread_mutex_lock (&writer_mutex);
+        cache_write_t *done = writer_batch;
+        writer_batch = NULL;
+        pthread_mutex_unlock (&writer_mutex);
+        waveform_db_write_list_free (done);
+        pthread_mutex_lock (&writer_mutex);
+    }
+    pthread_mutex_unlock (&writer_mutex);
+    return NULL;
+}
+
+static void
+waveform_db_writer_start (void)
+{
+    writer_stopping = 0;
+    if (pthread_create (&writer_thread, NULL, waveform_db_writer_thread, NULL) == 0) {
+        writer_running = 1;
+    }
+}
+
+// Commits everything still queued and joins the writer.
+static void
+waveform_db_writer_stop (void)
+{
+    if (!writer_running) {
+        return;
+    }
+    pthread_mutex_lock (&writer_mutex);
+    writer_stopping = 1;
+    pthread_cond_signal (&writer_cond);
+    pthread_mutex_unlock (&writer_mutex);
+    pthread_join (writer_thread, NULL);
+    writer_running = 0;
+}
 
 void
-waveform_db_open (const char* path)
+waveform_db_open (const char* path, int cache_backend)
 {
-    sqlite3_close(db);
+    waveform_db_close ();
+    backend = cache_backend;
+    if (backend == WAVE_CACHE_FILE) {
+        waveform_file_open (path);
+        waveform_db_writer_start ();
+        return;
+    }
     char db_path[1024] = "";
     snprintf (db_path, sizeof(db_path)/sizeof (char), "%s/%s", path, "wavecache.db");
     int rc = sqlite3_open(db_path, &db);
     if (rc) {
         fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
         sqlite3_close(db);
+        db = NULL;
         return;
     }
+    // readers don't block the writer and commits don't fsync every time
+    waveform_db_exec ("PRAGMA journal_mode=WAL");
+    waveform_db_exec ("PRAGMA synchronous=NORMAL");
+    waveform_db_writer_start ();
 }
 
 void
 waveform_db_close ()
 {
-    sqlite3_close(db);
+    waveform_db_writer_stop ();
+    waveform_file_close ();
+    if (waveform_db_lock ()) {
+        waveform_db_finalize ();
+        sqlite3_close(db);
+        db = NULL;
+        waveform_db_unlock ();
+    }
 }
 
 void
 waveform_db_init (char const *fname)
 {
-    char *zErrMsg = 0;
-    int rc;
+    if (!waveform_db_lock ()) {
+        return;
+    }
+    // only takes effect on new databases, lets eviction hand pages back
+    waveform_db_exec ("PRAGMA auto_vacuum=INCREMENTAL");
+    waveform_db_exec ("CREATE TABLE IF NOT EXISTS wave ( path TEXT PRIMARY KEY NOT NULL, channels INTEGER NOT NULL, compression INTEGER, data BLOB)");
+    waveform_db_migrate ();
+    // per connection set of keys for batch lookups
+    waveform_db_exec ("CREATE TEMP TABLE IF NOT EXISTS lookup ( path TEXT PRIMARY KEY NOT NULL)");
 
-    char *query = "CREATE TABLE IF NOT EXISTS wave ( path TEXT PRIMARY KEY NOT NULL, channels INTEGER NOT NULL, compression INTEGER, data BLOB)";
-    rc = sqlite3_exec(db, query, NULL, 0, &zErrMsg);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "SQL error: %s\n", zErrMsg);
+    waveform_db_finalize ();
+    for (int i = 0; i < N_CACHE_STMTS; i++) {
+        int rc = sqlite3_prepare_v2 (db, stmt_queries[i], -1, &stmts[i], NULL);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "prepare: SQL error: %s\n", sqlite3_errmsg(db));
+            stmts[i] = NULL;
+        }
     }
-    sqlite3_free(zErrMsg);
+    waveform_db_unlock ();
 }
 
 int
 waveform_db_cached (char const *fname)
 {
-    int rc;
-    sqlite3_stmt* p = 0;
+    pthread_mutex_lock (&writer_mutex);
+    const int pending = waveform_db_pending_find (fname) != NULL;
+    pthread_mutex_unlock (&writer_mutex);
+    if (pending) {
+        return 1;
+    }
+    if (backend == WAVE_CACHE_FILE) {
+        int channels, compression, bytes;
+        waveform_file_lock ();
+        const int result = waveform_file_lookup (fname, &channels, &compression, &bytes, NULL, NULL) != NULL;
+        waveform_file_unlock ();
+        return result;
+    }
+    if (!waveform_db_lock ()) {
+        return 0;
+    }
+    int result = 0;
+    sqlite3_stmt *p = waveform_db_stmt_begin (STMT_CACHED, fname);
+    if (p) {
+        result = sqlite3_step (p) == SQLITE_ROW;
+        waveform_db_stmt_end (p);
+    }
+    waveform_db_unlock ();
+    return result;
+}
 
-    char* query = sqlite3_mprintf ("SELECT * FROM wave WHERE path = '%q'", fname);
-    rc = sqlite3_prepare_v2 (db, query, strlen(query), &p, NULL);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "cached_perpare: SQL error: %d\n", rc);
+int
+waveform_db_delete (char const *fname)
+{
+    waveform_db_pending_drop (fname);
+    if (backend == WAVE_CACHE_FILE) {
+        return waveform_file_delete (fname);
     }
-    rc = sqlite3_step (p);
-    if (rc == SQLITE_ROW) {
-        sqlite3_finalize (p);
+    if (!waveform_db_lock ()) {
         return 1;
     }
-    sqlite3_finalize (p);
-    return 0;
+    sqlite3_stmt *p = waveform_db_stmt_begin (STMT_DELETE, fname);
+    if (p) {
+        int rc = sqlite3_step (p);
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "delete_exec: SQL error: %d\n", rc);
+        }
+        waveform_db_stmt_end (p);
+    }
+    waveform_db_unlock ();
+    return 1;
+}
+
+// Replaces the contents of the lookup table with keys. Call with the
+// db_mutex held and inside a transaction.
+static int
+waveform_db_lookup_fill (char **keys, int num_keys)
+{
+    if (!stmts[STMT_LOOKUP_CLEAR]) {
+        return 0;
+    }
+    sqlite3_step (stmts[STMT_LOOKUP_CLEAR]);
+    waveform_db_stmt_end (stmts[STMT_LOOKUP_CLEAR]);
+
+    for (int i = 0; i < num_keys; i++) {
+        if (!keys[i]) {
+            continue;
+        }
+        sqlite3_stmt *p = waveform_db_stmt_begin (STMT_LOOKUP_ADD, keys[i]);
+        if (!p) {
+            return 0;
+        }
+        int rc = sqlite3_step (p);
+        waveform_db_stmt_end (p);
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "lookup_add: SQL error: %d\n", rc);
+            return 0;
+        }
+    }
+    return 1;
 }
 
 int
-waveform_db_delete (char const *fname)
+waveform_db_cached_batch (char **keys, int num_keys)
 {
-    int rc;
-    sqlite3_stmt* p = 0;
+    if (backend == WAVE_CACHE_FILE) {
+        // index probes are cheap enough on their own
+        int result = 0;
+        for (int i = 0; i < num_keys; i++) {
+            result += keys[i] && waveform_db_cached (keys[i]);
+        }
+        return result;
+    }
+    if (!db || num_keys <= 0) {
+        return 0;
+    }
+    // pending writes count as cached, only the rest is looked up
+    char **stored_keys = malloc (num_keys * sizeof (char *));
+    if (!stored_keys) {
+        return 0;
+    }
+    int result = 0;
+    int num_stored = 0;
+    pthread_mutex_lock (&writer_mutex);
+    for (int i = 0; i < num_keys; i++) {
+        if (keys[i] && waveform_db_pending_find (keys[i])) {
+            result++;
+        }
+        else {
+            stored_keys[num_stored++] = keys[i];
+        }
+    }
+    pthread_mutex_unlock (&writer_mutex);
 
-    char* query = sqlite3_mprintf ("DELETE FROM wave WHERE path = '%q'", fname);
-    rc = sqlite3_prepare_v2 (db, query, strlen(query), &p, NULL);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "delete_perpare: SQL error: %d\n", rc);
+    if (!waveform_db_lock ()) {
+        free (stored_keys);
+        return result;
     }
-    rc = sqlite3_step (p);
-    if (rc != SQLITE_DONE) {
-        fprintf(stderr, "delete_exec: SQL error: %d\n", rc);
+    waveform_db_exec ("BEGIN");
+    sqlite3_stmt *p = stmts[STMT_LOOKUP_COUNT];
+    if (p && waveform_db_lookup_fill (stored_keys, num_stored)) {
+        if (sqlite3_step (p) == SQLITE_ROW) {
+            result += sqlite3_column_int (p, 0);
+        }
+        waveform_db_stmt_end (p);
     }
-    sqlite3_finalize (p);
+    waveform_db_exec ("COMMIT");
+    waveform_db_unlock ();
+    free (stored_keys);
+    return result;
+}
+
+int
+waveform_db_delete_batch (char **keys, int num_keys)
+{
+    for (int i = 0; i < num_keys; i++) {
+        if (keys[i]) {
+            waveform_db_pending_drop (keys[i]);
+        }
+    }
+    if (backend == WAVE_CACHE_FILE) {
+        for (int i = 0; i < num_keys; i++) {
+            if (keys[i]) {
+                waveform_file_delete (keys[i]);
+            }
+        }
+        return 1;
+    }
+    if (num_keys <= 0 || !waveform_db_lock ()) {
+        return 1;
+    }
+    waveform_db_exec ("BEGIN");
+    sqlite3_stmt *p = stmts[STMT_LOOKUP_DELETE];
+    if (p && waveform_db_lookup_fill (keys, num_keys)) {
+        int rc = sqlite3_step (p);
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "delete_batch: SQL error: %d\n", rc);
+        }
+        waveform_db_stmt_end (p);
+    }
+    waveform_db_exec ("COMMIT");
+    waveform_db_unlock ();
     return 1;
 }
 
 int
-waveform_db_read (char const *fname, short *buffer, int buffer_len, int *channels)
+waveform_db_fingerprint (char const *fname, waveform_fingerprint_t *fingerprint)
+{
+    memset (fingerprint, 0, sizeof (waveform_fingerprint_t));
+    pthread_mutex_lock (&writer_mutex);
+    cache_write_t *pending = waveform_db_pending_find (fname);
+    if (pending && pending->has_fingerprint) {
+        *fingerprint = pending->fingerprint;
+    }
+    pthread_mutex_unlock (&writer_mutex);
+    if (pending) {
+        return 1;
+    }
+    if (backend == WAVE_CACHE_FILE) {
+        int channels, compression, bytes;
+        waveform_file_lock ();
+        const int result = waveform_file_lookup (fname, &channels, &compression, &bytes, fingerprint, NULL) != NULL;
+        waveform_file_unlock ();
+        return result;
+    }
+    if (!waveform_db_lock ()) {
+        return 0;
+    }
+    int result = 0;
+    sqlite3_stmt *p = waveform_db_stmt_begin (STMT_FINGERPRINT_GET, fname);
+    if (p) {
+        if (sqlite3_step (p) == SQLITE_ROW) {
+            // NULL columns of old rows read as 0, i.e. unknown
+            fingerprint->size = sqlite3_column_int64 (p, 0);
+            fingerprint->mtime = sqlite3_column_int64 (p, 1);
+            fingerprint->content_hash = (uint64_t)sqlite3_column_int64 (p, 2);
+            result = 1;
+        }
+        waveform_db_stmt_end (p);
+    }
+    waveform_db_unlock ();
+    return result;
+}
+
+void
+waveform_db_fingerprint_update (char const *fname, const waveform_fingerprint_t *fingerprint)
 {
-    int rc;
-    sqlite3_stmt* p = 0;
+    pthread_mutex_lock (&writer_mutex);
+    cache_write_t *pending = waveform_db_pending_find (fname);
+    if (pending) {
+        pending->fingerprint = *fingerprint;
+        pending->has_fingerprint = 1;
+    }
+    pthread_mutex_unlock (&writer_mutex);
+    if (backend == WAVE_CACHE_FILE) {
+        waveform_file_fingerprint_set (fname, fingerprint);
+        return;
+    }
+    if (!waveform_db_lock ()) {
+        return;
+    }
+    sqlite3_stmt *p = waveform_db_stmt_begin (STMT_FINGERPRINT_SET, fname);
+    if (p) {
+        sqlite3_bind_int64 (p, 2, fingerprint->size);
+        sqlite3_bind_int64 (p, 3, fingerprint->mtime);
+        sqlite3_bind_int64 (p, 4, (sqlite3_int64)fingerprint->content_hash);
+        int rc = sqlite3_step (p);
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "fingerprint_exec: SQL error: %d\n", rc);
+        }
+        waveform_db_stmt_end (p);
+    }
+    waveform_db_unlock ();
+}
 
-    char* query = sqlite3_mprintf("SELECT channels, data FROM wave WHERE path = '%q'", fname);
-    rc = sqlite3_prepare_v2 (db, query, strlen(query), &p, NULL);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "read_perpare: SQL error: %d\n", rc);
+int
+waveform_db_info (char const *fname, waveform_db_info_t *info)
+{
+    memset (info, 0, sizeof (waveform_db_info_t));
+    pthread_mutex_lock (&writer_mutex);
+    cache_write_t *pending = waveform_db_pending_find (fname);
+    if (pending) {
+        *info = pending->info;
+    }
+    pthread_mutex_unlock (&writer_mutex);
+    if (pending) {
+        return 1;
+    }
+    if (backend == WAVE_CACHE_FILE) {
+        int channels, compression, bytes;
+        waveform_file_lock ();
+        const int result = waveform_file_lookup (fname, &channels, &compression, &bytes, NULL, info) != NULL;
+        waveform_file_unlock ();
+        return result;
     }
-    rc = sqlite3_step (p);
-    if (rc == SQLITE_DONE) {
-        sqlite3_finalize (p);
+    if (!waveform_db_lock ()) {
         return 0;
     }
-    else if (rc != SQLITE_ROW) {
-        fprintf(stderr, "read_exec: SQL error: %d\n", rc);
-        sqlite3_finalize (p);
+    int result = 0;
+    sqlite3_stmt *p = waveform_db_stmt_begin (STMT_INFO_GET, fname);
+    if (p) {
+        if (sqlite3_step (p) == SQLITE_ROW) {
+            info->samples = sqlite3_column_int (p, 0);
+            info->samplerate = sqlite3_column_int (p, 1);
+            info->duration = sqlite3_column_double (p, 2);
+            result = 1;
+        }
+        waveform_db_stmt_end (p);
+    }
+    waveform_db_unlock ();
+    return result;
+}
+
+int
+waveform_db_levels_supported (void)
+{
+    return backend != WAVE_CACHE_FILE && db;
+}
+
+void
+waveform_db_level_write (char const *fname, short *buffer, int buffer_len, int channels, int compression, const waveform_db_info_t *info)
+{
+    if (backend == WAVE_CACHE_FILE || !db) {
+        return;
+    }
+    unsigned char *encoded = waveform_db_encode (buffer, &buffer_len, channels, &compression);
+    if (compression < 0) {
+        return;
+    }
+    if (!waveform_db_lock ()) {
+        free (encoded);
+        return;
+    }
+    sqlite3_stmt *p = waveform_db_stmt_begin (STMT_LEVEL_WRITE, fname);
+    if (p) {
+        sqlite3_bind_int (p, 2, info->samples);
+        sqlite3_bind_int (p, 3, info->samplerate);
+        sqlite3_bind_double (p, 4, info->duration);
+        sqlite3_bind_int (p, 5, channels);
+        sqlite3_bind_int (p, 6, compression);
+        sqlite3_bind_blob (p, 7, encoded ? (void *)encoded : (void *)buffer, buffer_len, SQLITE_STATIC);
+        int rc = sqlite3_step (p);
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "level_write: SQL error: %d\n", rc);
+        }
+        waveform_db_stmt_end (p);
+    }
+    waveform_db_unlock ();
+    free (encoded);
+}
+
+int
+waveform_db_level_read (char const *fname, int min_samples, short *buffer, int buffer_len, int *channels, waveform_db_info_t *info)
+{
+    memset (info, 0, sizeof (waveform_db_info_t));
+    if (backend == WAVE_CACHE_FILE || !waveform_db_lock ()) {
         return 0;
     }
+    int n = 0;
+    sqlite3_stmt *p = waveform_db_stmt_begin (STMT_LEVEL_READ, fname);
+    if (p) {
+        sqlite3_bind_int (p, 2, min_samples);
+        if (sqlite3_step (p) == SQLITE_ROW) {
+            *channels = sqlite3_column_int (p, 0);
+            const int compression = sqlite3_column_int (p, 1);
+            const void *data = sqlite3_column_blob (p, 2);
+            const int bytes = sqlite3_column_bytes (p, 2);
+            info->samples = sqlite3_column_int (p, 3);
+            info->samplerate = sqlite3_column_int (p, 4);
+            info->duration = sqlite3_column_double (p, 5);
+            n = waveform_db_decode (compression, data, bytes, *channels, buffer, buffer_len);
+        }
+        waveform_db_stmt_end (p);
+    }
+    waveform_db_unlock ();
+    return n;
+}
 
-    *channels = sqlite3_column_int (p,0);
-    short *data = (short *)sqlite3_column_blob (p,1);
+int
+waveform_db_evict (int64_t max_bytes, int max_entries)
+{
+    if (max_bytes <= 0) {
+        return 0;
+    }
+    if (backend == WAVE_CACHE_FILE) {
+        // compacts in one go
+        waveform_file_evict (max_bytes);
+        return 0;
+    }
+    if (!waveform_db_lock ()) {
+        return 0;
+    }
+    int more = 0;
+    sqlite3_stmt *p = stmts[STMT_EVICT_SIZE];
+    if (p && sqlite3_step (p) == SQLITE_ROW) {
+        more = sqlite3_column_int64 (p, 0) > max_bytes;
+    }
+    if (p) {
+        waveform_db_stmt_end (p);
+    }
+    p = stmts[STMT_EVICT_DELETE];
+    if (more && p) {
+        sqlite3_bind_int (p, 1, max_entries);
+        int rc = sqlite3_step (p);
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "evict_exec: SQL error: %d\n", rc);
+            more = 0;
+        }
+        waveform_db_stmt_end (p);
+        waveform_db_exec ("PRAGMA incremental_vacuum");
+    }
+    waveform_db_unlock ();
+    return more;
+}
 
-    int bytes = sqlite3_column_bytes (p,1);
-    if (bytes > buffer_len * sizeof(short)) {
-        bytes = buffer_len;
+int
+waveform_db_read (char const *fname, short *buffer, int buffer_len, int *channels)
+{
+    pthread_mutex_lock (&writer_mutex);
+    cache_write_t *pending = waveform_db_pending_find (fname);
+    int n = 0;
+    if (pending) {
+        *channels = pending->channels;
+        n = MIN (pending->data_len / sizeof (short), buffer_len);
+        memcpy (buffer, pending->data, n * sizeof (short));
+    }
+    pthread_mutex_unlock (&writer_mutex);
+    if (pending) {
+        return n;
+    }
+    if (backend == WAVE_CACHE_FILE) {
+        // decodes straight out of the mapped data file
+        int compression, bytes;
+        waveform_file_lock ();
+        const void *data = waveform_file_lookup (fname, channels, &compression, &bytes, NULL, NULL);
+        const int n = waveform_db_decode (compression, data, bytes, *channels, buffer, buffer_len);
+        waveform_file_unlock ();
+        if (data) {
+            waveform_file_touch (fname);
+        }
+        return n;
     }
-    memcpy (buffer,data,bytes);
+    if (!waveform_db_lock ()) {
+        return 0;
+    }
+    sqlite3_stmt *p = waveform_db_stmt_begin (STMT_READ, fname);
+    if (p) {
+        int rc = sqlite3_step (p);
+        if (rc == SQLITE_ROW) {
+            *channels = sqlite3_column_int (p,0);
+            const int compression = sqlite3_column_int (p,1);
+            const void *data = sqlite3_column_blob (p,2);
+            const int bytes = sqlite3_column_bytes (p,2);
+            n = waveform_db_decode (compression, data, bytes, *channels, buffer, buffer_len);
+        }
+        else if (rc != SQLITE_DONE) {
+            fprintf(stderr, "read_exec: SQL error: %d\n", rc);
+        }
+        waveform_db_stmt_end (p);
 
-    sqlite3_finalize (p);
-    return bytes / sizeof(short);
+        sqlite3_stmt *touch = rc == SQLITE_ROW ? waveform_db_stmt_begin (STMT_TOUCH, fname) : NULL;
+        if (touch) {
+            sqlite3_bind_int64 (touch, 2, time (NULL));
+            sqlite3_step (touch);
+            waveform_db_stmt_end (touch);
+        }
+    }
+    waveform_db_unlock ();
+    return n;
 }
 
 void
-waveform_db_write (char const *fname, short *buffer, int buffer_len, int channels, int compression)
+waveform_db_write (char const *fname,
+                   short *buffer,
+                   int buffer_len,
+                   int channels,
+                   int compression,
+                   const waveform_fingerprint_t *fingerprint,
+                   const waveform_db_info_t *info)
 {
-    int rc;
-    sqlite3_stmt* p = 0;
+    if (!writer_running) {
+        waveform_db_store (fname, buffer, buffer_len, channels, compression, fingerprint, info);
+        return;
+    }
+    cache_write_t *q = malloc (sizeof (cache_write_t));
+    if (!q) {
+        return;
+    }
+    memset (q, 0, sizeof (cache_write_t));
+    q->fname = strdup (fname);
+    q->data = malloc (buffer_len);
+    if (!q->fname || !q->data) {
+        waveform_db_write_list_free (q);
+        return;
+    }
+    memcpy (q->data, buffer, buffer_len);
+    q->data_len = buffer_len;
+    q->channels = channels;
+    q->compression = compression;
+    if (fingerprint) {
+        q->fingerprint = *fingerprint;
+        q->has_fingerprint = 1;
+    }
+    if (info) {
+        q->info = *info;
+    }
 
-    char* query = "INSERT INTO wave (path, channels, compression, data) VALUES (?, ?, ?, ?);";
-    rc = sqlite3_prepare_v2 (db, query, strlen(query), &p, NULL);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "write_perpare: SQL error: %d\n", rc);
+    pthread_mutex_lock (&writer_mutex);
+    if (writer_queue_tail) {
+        writer_queue_tail->next = q;
     }
-    rc = sqlite3_bind_text (p, 1, fname, -1, SQLITE_STATIC);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "write_fname: SQL error: %d\n", rc);
+    else {
+        writer_queue = q;
     }
-    rc = sqlite3_bind_int (p, 2, channels);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "write_channels: SQL error: %d\n", rc);
+    writer_queue_tail = q;
+    writer_queue_len++;
+    pthread_cond_signal (&writer_cond);
+    pthread_mutex_unlock (&writer_mutex);
+}
+
+static void
+waveform_db_store (char const *fname,
+                   short *buffer,
+                   int buffer_len,
+                   int channels,
+                   int compression,
+                   const waveform_fingerprint_t *fingerprint,
+                   const waveform_db_info_t *info)
+{
+    if (backend != WAVE_CACHE_FILE && !db) {
+        return;
     }
-    rc = sqlite3_bind_int (p, 3, compression);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "write_compression: SQL error: %d\n", rc);
+    unsigned char *encoded = waveform_db_encode (buffer, &buffer_len, channels, &compression);
+    if (compression < 0) {
+        return;
     }
-    rc = sqlite3_bind_blob (p, 4, buffer, buffer_len, SQLITE_STATIC);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "write_data: SQL error: %d\n", rc);
+
+    if (backend == WAVE_CACHE_FILE) {
+        waveform_file_write (fname, encoded ? (void *)encoded : (void *)buffer, buffer_len, channels, compression, fingerprint, info);
+        free (encoded);
+        return;
+    }
+
+    if (!waveform_db_lock ()) {
+        free (encoded);
+        return;
     }
-    rc = sqlite3_step (p);
-    if (rc != SQLITE_DONE) {
-        fprintf(stderr, "write_exec: SQL error: %d\n", rc);
+    sqlite3_stmt *p = waveform_db_stmt_begin (STMT_WRITE, fname);
+    if (p) {
+        int rc = sqlite3_bind_int (p, 2, channels);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "write_channels: SQL error: %d\n", rc);
+        }
+        rc = sqlite3_bind_int (p, 3, compression);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "write_compression: SQL error: %d\n", rc);
+        }
+        rc = sqlite3_bind_blob (p, 4, encoded ? (void *)encoded : (void *)buffer, buffer_len, SQLITE_STATIC);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "write_data: SQL error: %d\n", rc);
+        }
+        if (fingerprint) {
+            sqlite3_bind_int64 (p, 5, fingerprint->size);
+            sqlite3_bind_int64 (p, 6, fingerprint->mtime);
+            sqlite3_bind_int64 (p, 7, (sqlite3_int64)fingerprint->content_hash);
+        }
+        sqlite3_bind_int64 (p, 8, time (NULL));
+        if (info) {
+            sqlite3_bind_int (p, 9, info->samples);
+            sqlite3_bind_int (p, 10, info->samplerate);
+            sqlite3_bind_double (p, 11, info->duration);
+        }
+        rc = sqlite3_step (p);
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "write_exec: SQL error: %d\n", rc);
+        }
+        waveform_db_stmt_end (p);
+    }
+    waveform_db_unlock ();
+    if (encoded) {
+        free (encoded);
+        encoded = NULL;
     }
-    sqlite3_finalize (p);
 }
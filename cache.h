@@ -24,6 +24,8 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+#pragma once
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -31,10 +33,50 @@
 #include <assert.h>
 #include <math.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
 #include <sqlite3.h>
 
+// Encodings of the data column, stored in the compression column
+enum WAVE_COMPRESSION {
+    // raw shorts
+    WAVE_COMPRESSION_NONE = 0,
+    // per value stream deltas, zigzag and varint encoded, lossless
+    WAVE_COMPRESSION_DELTA = 1,
+    // one byte per value, sign and log scaled magnitude
+    WAVE_COMPRESSION_LOG8 = 2,
+    N_WAVE_COMPRESSIONS
+};
+
+// Identifies the state of a file when its waveform was cached, a size or
+// mtime of 0 means unknown.
+typedef struct
+{
+    int64_t size;
+    int64_t mtime;
+    // hash of a short decoded window, 0 if not computed
+    uint64_t content_hash;
+} waveform_fingerprint_t;
+
+// The analysis a cached waveform came from, 0 means unknown.
+typedef struct
+{
+    // number of slots the track was divided into
+    int samples;
+    int samplerate;
+    // track duration in seconds
+    float duration;
+} waveform_db_info_t;
+
+enum WAVE_CACHE_BACKEND {
+    WAVE_CACHE_SQLITE = 0,
+    // memory-mapped append-only data file with a hashed index
+    WAVE_CACHE_FILE = 1,
+    N_WAVE_CACHE_BACKENDS
+};
+
 void
-waveform_db_open (const char *fname);
+waveform_db_open (const char *fname, int cache_backend);
 
 void
 waveform_db_close ();
@@ -48,8 +90,55 @@ waveform_db_cached (char const *fname);
 int
 waveform_db_delete (char const *fname);
 
+// Returns how many of the keys are cached, checked in a single transaction.
+int
+waveform_db_cached_batch (char **keys, int num_keys);
+
+// Deletes all keys in a single transaction.
+int
+waveform_db_delete_batch (char **keys, int num_keys);
+
+// Fills the stored fingerprint of fname, returns 0 if fname isn't cached.
+int
+waveform_db_fingerprint (char const *fname, waveform_fingerprint_t *fingerprint);
+
+void
+waveform_db_fingerprint_update (char const *fname, const waveform_fingerprint_t *fingerprint);
+
+// Fills the analysis parameters of fname, returns 0 if fname isn't cached.
+int
+waveform_db_info (char const *fname, waveform_db_info_t *info);
+
+// Removes up to max_entries of the least recently read entries if the cache
+// holds more than max_bytes of waveform data. Returns 1 if it might still be
+// too large, i.e. should be called again.
+int
+waveform_db_evict (int64_t max_bytes, int max_entries);
+
 int
 waveform_db_read (char const *fname, short *buffer, int buffer_len, int *channels);
 
+// Queues a copy of buffer for the writer thread, which commits pending
+// writes in batches. Pending writes are visible to all other calls.
 void
-waveform_db_write (char const *fname, short *buffer, int buffer_len, int channels, int compression);
+waveform_db_write (char const *fname,
+                   short *buffer,
+                   int buffer_len,
+                   int channels,
+                   int compression,
+                   const waveform_fingerprint_t *fingerprint,
+                   const waveform_db_info_t *info);
+
+// Extra whole-track resolutions of a cached waveform, keyed by info->samples
+// and dropped together with it. Only the sqlite backend stores them.
+void
+waveform_db_level_write (char const *fname, short *buffer, int buffer_len, int channels, int compression, const waveform_db_info_t *info);
+
+// Reads the coarsest level of at least min_samples slots. Returns the number
+// of shorts read, 0 if there is none.
+int
+waveform_db_level_read (char const *fname, int min_samples, short *buffer, int buffer_len, int *channels, waveform_db_info_t *info);
+
+// Returns 1 if the open backend can store levels.
+int
+waveform_db_levels_supported (void);
@@ -0,0 +1,678 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "cache_file.h"
+
+#define INDEX_MAGIC (0x58444957) // "WIDX"
+#define DATA_MAGIC (0x54414457) // "WDAT"
+#define RECORD_MAGIC (0x43455257) // "WREC"
+#define FILE_VERSION (3)
+#define INDEX_MIN_CAPACITY (4096)
+#define DATA_MIN_MAP_SIZE (1 << 20)
+#define OFFSET_EMPTY (0)
+#define OFFSET_DELETED (UINT64_MAX)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    // slots holding an entry or a tombstone
+    uint64_t used;
+} index_header_t;
+
+typedef struct
+{
+    uint64_t hash;
+    // offset of the record in the data file
+    uint64_t offset;
+} index_entry_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+} data_header_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t key_len;
+    int32_t channels;
+    int32_t compression;
+    uint32_t data_len;
+    // last read or write, seconds since the epoch
+    uint32_t accessed;
+    int64_t size;
+    int64_t mtime;
+    uint64_t content_hash;
+    int32_t samples;
+    int32_t samplerate;
+    double duration;
+} record_header_t;
+
+static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char file_dir[1024];
+
+static int index_fd = -1;
+static index_header_t *index_map;
+static size_t index_map_size;
+
+static int data_fd = -1;
+// may reach past data_end, only bytes below it are ever read
+static const char *data_map;
+static size_t data_map_size;
+// append position, size of the data file
+static uint64_t data_end;
+
+static uint64_t
+waveform_file_hash (const char *key)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static inline index_entry_t *
+waveform_file_entries (void)
+{
+    return (index_entry_t *)(index_map + 1);
+}
+
+static inline size_t
+waveform_file_record_size (uint32_t key_len, uint32_t data_len)
+{
+    // keep records 8 byte aligned
+    return (sizeof (record_header_t) + key_len + data_len + 7) & ~(size_t)7;
+}
+
+static int
+waveform_file_index_map (uint64_t capacity)
+{
+    if (index_map) {
+        munmap (index_map, index_map_size);
+        index_map = NULL;
+    }
+    index_map_size = sizeof (index_header_t) + capacity * sizeof (index_entry_t);
+    void *map = mmap (NULL, index_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf (stderr, "waveform: failed to map cache index\n");
+        index_map_size = 0;
+        return -1;
+    }
+    index_map = map;
+    return 0;
+}
+
+static void
+waveform_file_data_unmap (void)
+{
+    if (data_map) {
+        munmap ((void *)data_map, data_map_size);
+        data_map = NULL;
+        data_map_size = 0;
+    }
+}
+
+// Maps the data file up to at least its current end, needed after
+// appending. The mapping grows in doubling steps, so appends only remap
+// once in a while.
+static int
+waveform_file_data_map (void)
+{
+    if (data_map && data_map_size >= data_end) {
+        return 0;
+    }
+    size_t size = data_map_size > DATA_MIN_MAP_SIZE ? data_map_size : DATA_MIN_MAP_SIZE;
+    while (size < data_end) {
+        size *= 2;
+    }
+    waveform_file_data_unmap ();
+    void *map = mmap (NULL, size, PROT_READ, MAP_SHARED, data_fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf (stderr, "waveform: failed to map cache data\n");
+        return -1;
+    }
+    data_map = map;
+    data_map_size = size;
+    return 0;
+}
+
+// Returns the record at offset if it is intact and belongs to key.
+static const record_header_t *
+waveform_file_record (uint64_t offset, const char *key, size_t key_len)
+{
+    if (offset < sizeof (data_header_t) || offset + sizeof (record_header_t) > data_end) {
+        return NULL;
+    }
+    const record_header_t *rec = (const record_header_t *)(data_map + offset);
+    if (rec->magic != RECORD_MAGIC
+        || rec->key_len != key_len
+        || offset + waveform_file_record_size (rec->key_len, rec->data_len) > data_end) {
+        return NULL;
+    }
+    if (memcmp (rec + 1, key, key_len) != 0) {
+        return NULL;
+    }
+    return rec;
+}
+
+// Returns the slot holding key or NULL. With insert, returns the slot the key
+// should be stored in instead.
+static index_entry_t *
+waveform_file_probe (const char *key, uint64_t hash, int insert)
+{
+    const size_t key_len = strlen (key);
+    const uint64_t mask = index_map->capacity - 1;
+    index_entry_t *entries = waveform_file_entries ();
+    index_entry_t *free_slot = NULL;
+
+    for (uint64_t i = hash & mask, n = 0; n < index_map->capacity; i = (i + 1) & mask, n++) {
+        index_entry_t *e = &entries[i];
+        if (e->offset == OFFSET_EMPTY) {
+            if (insert) {
+                return free_slot ? free_slot : e;
+            }
+            return NULL;
+        }
+        if (e->offset == OFFSET_DELETED) {
+            if (!free_slot) {
+                free_slot = e;
+            }
+            continue;
+        }
+        if (e->hash == hash && waveform_file_record (e->offset, key, key_len)) {
+            return e;
+        }
+    }
+    return insert ? free_slot : NULL;
+}
+
+// Doubles the index once more than half of it is in use, dropping tombstones.
+static int
+waveform_file_index_grow (void)
+{
+    const uint64_t old_capacity = index_map->capacity;
+    index_entry_t *old = malloc (old_capacity * sizeof (index_entry_t));
+    if (!old) {
+        return -1;
+    }
+    memcpy (old, waveform_file_entries (), old_capacity * sizeof (index_entry_t));
+
+    const uint64_t capacity = old_capacity * 2;
+    if (ftruncate (index_fd, sizeof (index_header_t) + capacity * sizeof (index_entry_t)) != 0
+        || waveform_file_index_map (capacity) != 0) {
+        free (old);
+        return -1;
+    }
+    index_map->capacity = capacity;
+    index_map->used = 0;
+    index_entry_t *entries = waveform_file_entries ();
+    memset (entries, 0, capacity * sizeof (index_entry_t));
+
+    const uint64_t mask = capacity - 1;
+    for (uint64_t j = 0; j < old_capacity; j++) {
+        if (old[j].offset == OFFSET_EMPTY || old[j].offset == OFFSET_DELETED) {
+            continue;
+        }
+        uint64_t i = old[j].hash & mask;
+        while (entries[i].offset != OFFSET_EMPTY) {
+            i = (i + 1) & mask;
+        }
+        entries[i] = old[j];
+        index_map->used++;
+    }
+    free (old);
+    return 0;
+}
+
+static int
+waveform_file_open_fd (const char *path, const char *name)
+{
+    char file_path[1024] = "";
+    snprintf (file_path, sizeof (file_path), "%s/%s", path, name);
+    int fd = open (file_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf (stderr, "waveform: can't open cache file %s\n", file_path);
+    }
+    return fd;
+}
+
+int
+waveform_file_open (const char *path)
+{
+    waveform_file_close ();
+    pthread_mutex_lock (&file_mutex);
+
+    snprintf (file_dir, sizeof (file_dir), "%s", path);
+    index_fd = waveform_file_open_fd (path, "wavecache.idx");
+    data_fd = waveform_file_open_fd (path, "wavecache.dat");
+    if (index_fd < 0 || data_fd < 0) {
+        goto fail;
+    }
+
+    struct stat st;
+    if (fstat (data_fd, &st) != 0) {
+        goto fail;
+    }
+    data_header_t data_header = { 0 };
+    if (st.st_size >= (off_t)sizeof (data_header_t)
+        && pread (data_fd, &data_header, sizeof (data_header), 0) != sizeof (data_header)) {
+        goto fail;
+    }
+    if (data_header.magic != DATA_MAGIC || data_header.version != FILE_VERSION) {
+        // new or written by another version, start over
+        data_header.magic = DATA_MAGIC;
+        data_header.version = FILE_VERSION;
+        if (ftruncate (data_fd, 0) != 0
+            || pwrite (data_fd, &data_header, sizeof (data_header), 0) != sizeof (data_header)) {
+            goto fail;
+        }
+        data_end = sizeof (data_header);
+        // a new data file invalidates whatever index is left
+        if (ftruncate (index_fd, 0) != 0) {
+            goto fail;
+        }
+    }
+    else {
+        data_end = st.st_size;
+    }
+    if (waveform_file_data_map () != 0) {
+        goto fail;
+    }
+
+    if (fstat (index_fd, &st) != 0) {
+        goto fail;
+    }
+    uint64_t capacity = INDEX_MIN_CAPACITY;
+    int create = st.st_size < (off_t)sizeof (index_header_t);
+    if (!create) {
+        index_header_t header;
+        if (pread (index_fd, &header, sizeof (header), 0) != sizeof (header)) {
+            goto fail;
+        }
+        create = header.magic != INDEX_MAGIC
+            || header.version != FILE_VERSION
+            || header.capacity < INDEX_MIN_CAPACITY
+            || (header.capacity & (header.capacity - 1))
+            || st.st_size < (off_t)(sizeof (index_header_t) + header.capacity * sizeof (index_entry_t));
+        capacity = create ? INDEX_MIN_CAPACITY : header.capacity;
+    }
+    if (create && ftruncate (index_fd, 0) != 0) {
+        goto fail;
+    }
+    if (create && ftruncate (index_fd, sizeof (index_header_t) + capacity * sizeof (index_entry_t)) != 0) {
+        goto fail;
+    }
+    if (waveform_file_index_map (capacity) != 0) {
+        goto fail;
+    }
+    if (create) {
+        index_map->magic = INDEX_MAGIC;
+        index_map->version = FILE_VERSION;
+        index_map->capacity = capacity;
+        index_map->used = 0;
+    }
+
+    pthread_mutex_unlock (&file_mutex);
+    return 0;
+
+fail:
+    pthread_mutex_unlock (&file_mutex);
+    waveform_file_close ();
+    return -1;
+}
+
+void
+waveform_file_close (void)
+{
+    pthread_mutex_lock (&file_mutex);
+    if (index_map) {
+        munmap (index_map, index_map_size);
+        index_map = NULL;
+        index_map_size = 0;
+    }
+    waveform_file_data_unmap ();
+    if (index_fd >= 0) {
+        close (index_fd);
+        index_fd = -1;
+    }
+    if (data_fd >= 0) {
+        close (data_fd);
+        data_fd = -1;
+    }
+    data_end = 0;
+    pthread_mutex_unlock (&file_mutex);
+}
+
+void
+waveform_file_lock (void)
+{
+    pthread_mutex_lock (&file_mutex);
+}
+
+void
+waveform_file_unlock (void)
+{
+    pthread_mutex_unlock (&file_mutex);
+}
+
+const void *
+waveform_file_lookup (const char *key,
+                      int *channels,
+                      int *compression,
+                      int *bytes,
+                      waveform_fingerprint_t *fingerprint,
+                      waveform_db_info_t *info)
+{
+    if (!index_map || !data_map) {
+        return NULL;
+    }
+    index_entry_t *e = waveform_file_probe (key, waveform_file_hash (key), 0);
+    if (!e) {
+        return NULL;
+    }
+    const record_header_t *rec = (const record_header_t *)(data_map + e->offset);
+    *channels = rec->channels;
+    *compression = rec->compression;
+    *bytes = rec->data_len;
+    if (fingerprint) {
+        fingerprint->size = rec->size;
+        fingerprint->mtime = rec->mtime;
+        fingerprint->content_hash = rec->content_hash;
+    }
+    if (info) {
+        info->samples = rec->samples;
+        info->samplerate = rec->samplerate;
+        info->duration = rec->duration;
+    }
+    return (const char *)(rec + 1) + rec->key_len;
+}
+
+int
+waveform_file_fingerprint_set (const char *key, const waveform_fingerprint_t *fingerprint)
+{
+    int result = -1;
+    pthread_mutex_lock (&file_mutex);
+    if (index_map && data_map) {
+        index_entry_t *e = waveform_file_probe (key, waveform_file_hash (key), 0);
+        if (e) {
+            // the mapping is read-only, write through the file instead
+            const int64_t values[3] = { fingerprint->size, fingerprint->mtime, (int64_t)fingerprint->content_hash };
+            const off_t pos = e->offset + offsetof (record_header_t, size);
+            if (pwrite (data_fd, values, sizeof (values), pos) == sizeof (values)) {
+                result = 0;
+            }
+        }
+    }
+    pthread_mutex_unlock (&file_mutex);
+    return result;
+}
+
+int
+waveform_file_delete (const char *key)
+{
+    pthread_mutex_lock (&file_mutex);
+    if (index_map && data_map) {
+        index_entry_t *e = waveform_file_probe (key, waveform_file_hash (key), 0);
+        if (e) {
+            // the record stays in the data file, only the index forgets it
+            e->offset = OFFSET_DELETED;
+        }
+    }
+    pthread_mutex_unlock (&file_mutex);
+    return 1;
+}
+
+int
+waveform_file_write (const char *key,
+                     const void *data,
+                     int bytes,
+                     int channels,
+                     int compression,
+                     const waveform_fingerprint_t *fingerprint,
+                     const waveform_db_info_t *info)
+{
+    int result = -1;
+    pthread_mutex_lock (&file_mutex);
+    if (!index_map || !data_map || bytes < 0) {
+        goto out;
+    }
+    if ((index_map->used + 1) * 2 > index_map->capacity && waveform_file_index_grow () != 0) {
+        goto out;
+    }
+
+    const size_t key_len = strlen (key);
+    const size_t record_size = waveform_file_record_size (key_len, bytes);
+    char *record = calloc (1, record_size);
+    if (!record) {
+        goto out;
+    }
+    record_header_t *rec = (record_header_t *)record;
+    rec->magic = RECORD_MAGIC;
+    rec->key_len = key_len;
+    rec->channels = channels;
+    rec->compression = compression;
+    rec->data_len = bytes;
+    rec->accessed = time (NULL);
+    if (fingerprint) {
+        rec->size = fingerprint->size;
+        rec->mtime = fingerprint->mtime;
+        rec->content_hash = fingerprint->content_hash;
+    }
+    if (info) {
+        rec->samples = info->samples;
+        rec->samplerate = info->samplerate;
+        rec->duration = info->duration;
+    }
+    memcpy (record + sizeof (record_header_t), key, key_len);
+    memcpy (record + sizeof (record_header_t) + key_len, data, bytes);
+
+    const uint64_t offset = data_end;
+    const ssize_t written = pwrite (data_fd, record, record_size, offset);
+    free (record);
+    if (written != (ssize_t)record_size) {
+        fprintf (stderr, "waveform: failed to write cache data\n");
+        goto out;
+    }
+    data_end += record_size;
+    if (waveform_file_data_map () != 0) {
+        goto out;
+    }
+
+    // the record is complete before the index points to it
+    const uint64_t hash = waveform_file_hash (key);
+    index_entry_t *e = waveform_file_probe (key, hash, 1);
+    if (!e) {
+        goto out;
+    }
+    if (e->offset == OFFSET_EMPTY) {
+        index_map->used++;
+    }
+    e->hash = hash;
+    e->offset = offset;
+    result = 0;
+
+out:
+    pthread_mutex_unlock (&file_mutex);
+    return result;
+}
+
+int
+waveform_file_touch (const char *key)
+{
+    int result = -1;
+    pthread_mutex_lock (&file_mutex);
+    if (index_map && data_map) {
+        index_entry_t *e = waveform_file_probe (key, waveform_file_hash (key), 0);
+        if (e) {
+            const uint32_t now = time (NULL);
+            const off_t pos = e->offset + offsetof (record_header_t, accessed);
+            if (pwrite (data_fd, &now, sizeof (now), pos) == sizeof (now)) {
+                result = 0;
+            }
+        }
+    }
+    pthread_mutex_unlock (&file_mutex);
+    return result;
+}
+
+typedef struct
+{
+    index_entry_t entry;
+    size_t size;
+    uint32_t accessed;
+} evict_entry_t;
+
+static int
+waveform_file_evict_cmp (const void *a, const void *b)
+{
+    const evict_entry_t *ea = a;
+    const evict_entry_t *eb = b;
+    // most recently accessed first
+    return ea->accessed < eb->accessed ? 1 : ea->accessed > eb->accessed ? -1 : 0;
+}
+
+// Rewrites the data file with the most recently accessed records that fit
+// into three quarters of max_bytes and rebuilds the index for them. Deleted
+// and evicted records only give back their space this way.
+int
+waveform_file_evict (int64_t max_bytes)
+{
+    int result = -1;
+    evict_entry_t *live = NULL;
+    int tmp_fd = -1;
+    char tmp_path[1100] = "";
+    char data_path[1100] = "";
+
+    pthread_mutex_lock (&file_mutex);
+    if (!index_map || !data_map) {
+        goto out;
+    }
+    if ((int64_t)data_end <= max_bytes) {
+        result = 0;
+        goto out;
+    }
+
+    const uint64_t capacity = index_map->capacity;
+    index_entry_t *entries = waveform_file_entries ();
+    live = malloc (capacity * sizeof (evict_entry_t));
+    if (!live) {
+        goto out;
+    }
+    size_t num_live = 0;
+    for (uint64_t i = 0; i < capacity; i++) {
+        const uint64_t offset = entries[i].offset;
+        if (offset == OFFSET_EMPTY || offset == OFFSET_DELETED
+            || offset < sizeof (data_header_t) || offset + sizeof (record_header_t) > data_end) {
+            continue;
+        }
+        const record_header_t *rec = (const record_header_t *)(data_map + offset);
+        const size_t size = waveform_file_record_size (rec->key_len, rec->data_len);
+        if (rec->magic != RECORD_MAGIC || offset + size > data_end) {
+            continue;
+        }
+        live[num_live].entry = entries[i];
+        live[num_live].size = size;
+        live[num_live].accessed = rec->accessed;
+        num_live++;
+    }
+    qsort (live, num_live, sizeof (evict_entry_t), waveform_file_evict_cmp);
+
+    snprintf (tmp_path, sizeof (tmp_path), "%s/%s", file_dir, "wavecache.dat.tmp");
+    snprintf (data_path, sizeof (data_path), "%s/%s", file_dir, "wavecache.dat");
+    tmp_fd = open (tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tmp_fd < 0) {
+        goto out;
+    }
+    const data_header_t data_header = { .magic = DATA_MAGIC, .version = FILE_VERSION };
+    if (pwrite (tmp_fd, &data_header, sizeof (data_header), 0) != sizeof (data_header)) {
+        goto out;
+    }
+    const uint64_t budget = max_bytes / 4 * 3;
+    uint64_t end = sizeof (data_header);
+    size_t num_kept = 0;
+    for (size_t i = 0; i < num_live; i++) {
+        if (end + live[i].size > budget) {
+            break;
+        }
+        if (pwrite (tmp_fd, data_map + live[i].entry.offset, live[i].size, end) != (ssize_t)live[i].size) {
+            goto out;
+        }
+        live[i].entry.offset = end;
+        end += live[i].size;
+        num_kept++;
+    }
+    if (rename (tmp_path, data_path) != 0) {
+        goto out;
+    }
+
+    // the old mapping belongs to the replaced file
+    waveform_file_data_unmap ();
+    close (data_fd);
+    data_fd = tmp_fd;
+    tmp_fd = -1;
+    data_end = end;
+
+    // the index has to match the new file even if it can't be mapped, in
+    // which case the cache stays unavailable until it is opened again
+    memset (entries, 0, capacity * sizeof (index_entry_t));
+    index_map->used = 0;
+    const uint64_t mask = capacity - 1;
+    for (size_t i = 0; i < num_kept; i++) {
+        uint64_t j = live[i].entry.hash & mask;
+        while (entries[j].offset != OFFSET_EMPTY) {
+            j = (j + 1) & mask;
+        }
+        entries[j] = live[i].entry;
+        index_map->used++;
+    }
+    if (waveform_file_data_map () != 0) {
+        goto out;
+    }
+    result = 0;
+
+out:
+    if (tmp_fd >= 0) {
+        close (tmp_fd);
+        unlink (tmp_path);
+    }
+    if (live) {
+        free (live);
+        live = NULL;
+    }
+    pthread_mutex_unlock (&file_mutex);
+    return result;
+}
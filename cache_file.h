@@ -0,0 +1,72 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#include "cache.h"
+
+// Cache backend storing waveforms in an append-only data file with a hashed
+// key index, both memory-mapped. Only used through cache.h.
+
+int
+waveform_file_open (const char *path);
+
+void
+waveform_file_close (void);
+
+// Guards the mappings, pointers returned by waveform_file_lookup are only
+// valid until waveform_file_unlock.
+void
+waveform_file_lock (void);
+
+void
+waveform_file_unlock (void);
+
+// Returns the stored (encoded) data of key or NULL. Call with the lock held,
+// fingerprint and info may be NULL.
+const void *
+waveform_file_lookup (const char *key,
+                      int *channels,
+                      int *compression,
+                      int *bytes,
+                      waveform_fingerprint_t *fingerprint,
+                      waveform_db_info_t *info);
+
+int
+waveform_file_fingerprint_set (const char *key, const waveform_fingerprint_t *fingerprint);
+
+int
+waveform_file_delete (const char *key);
+
+// Marks key as read just now.
+int
+waveform_file_touch (const char *key);
+
+// Drops the least recently accessed records until the data file fits into
+// max_bytes again.
+int
+waveform_file_evict (int64_t max_bytes);
+
+int
+waveform_file_write (const char *key,
+                     const void *data,
+                     int bytes,
+                     int channels,
+                     int compression,
+                     const waveform_fingerprint_t *fingerprint,
+                     const waveform_db_info_t *info);
@@ -42,6 +42,10 @@ gboolean CONFIG_LOG_ENABLED = FALSE;
 gboolean CONFIG_MIX_TO_MONO = FALSE;
 gboolean CONFIG_CACHE_ENABLED = TRUE;
 gboolean CONFIG_SCROLL_ENABLED = TRUE;
+gboolean CONFIG_PARALLEL_ANALYSIS = TRUE;
+gboolean CONFIG_SHARED_IMAGE_DECODE = TRUE;
+gboolean CONFIG_IDLE_SCAN = FALSE;
+gboolean CONFIG_CACHE_CONTENT_HASH = TRUE;
 gboolean CONFIG_DISPLAY_RMS = TRUE;
 gboolean CONFIG_DISPLAY_RULER = FALSE;
 gboolean CONFIG_SHADE_WAVEFORM = FALSE;
@@ -62,6 +66,12 @@ gint     CONFIG_FONT_SIZE = 18;
 gint     CONFIG_MAX_FILE_LENGTH = 180;
 gint     CONFIG_NUM_SAMPLES = 2048;
 gint     CONFIG_REFRESH_INTERVAL = 33;
+gint     CONFIG_ANALYSIS_THREADS = 2;
+gint     CONFIG_PREFETCH_TRACKS = 2;
+gint     CONFIG_CACHE_COMPRESSION = 1;
+gint     CONFIG_CACHE_BACKEND = 0;
+gint     CONFIG_CACHE_MAX_SIZE = 0;
+gint     CONFIG_MEMORY_CACHE_SIZE = 16;
 
 void
 save_config (void)
@@ -82,6 +92,16 @@ save_config (void)
     deadbeef->conf_set_int (CONFSTR_WF_NUM_SAMPLES,         CONFIG_NUM_SAMPLES);
     deadbeef->conf_set_int (CONFSTR_WF_CACHE_ENABLED,       CONFIG_CACHE_ENABLED);
     deadbeef->conf_set_int (CONFSTR_WF_SCROLL_ENABLED,      CONFIG_SCROLL_ENABLED);
+    deadbeef->conf_set_int (CONFSTR_WF_PARALLEL_ANALYSIS,   CONFIG_PARALLEL_ANALYSIS);
+    deadbeef->conf_set_int (CONFSTR_WF_SHARED_IMAGE_DECODE, CONFIG_SHARED_IMAGE_DECODE);
+    deadbeef->conf_set_int (CONFSTR_WF_ANALYSIS_THREADS,    CONFIG_ANALYSIS_THREADS);
+    deadbeef->conf_set_int (CONFSTR_WF_PREFETCH_TRACKS,     CONFIG_PREFETCH_TRACKS);
+    deadbeef->conf_set_int (CONFSTR_WF_IDLE_SCAN,           CONFIG_IDLE_SCAN);
+    deadbeef->conf_set_int (CONFSTR_WF_CACHE_COMPRESSION,   CONFIG_CACHE_COMPRESSION);
+    deadbeef->conf_set_int (CONFSTR_WF_CACHE_BACKEND,       CONFIG_CACHE_BACKEND);
+    deadbeef->conf_set_int (CONFSTR_WF_CACHE_CONTENT_HASH,  CONFIG_CACHE_CONTENT_HASH);
+    deadbeef->conf_set_int (CONFSTR_WF_CACHE_MAX_SIZE,      CONFIG_CACHE_MAX_SIZE);
+    deadbeef->conf_set_int (CONFSTR_WF_MEMORY_CACHE_SIZE,   CONFIG_MEMORY_CACHE_SIZE);
     deadbeef->conf_set_int (CONFSTR_WF_BG_COLOR_R,          CONFIG_BG_COLOR.red);
     deadbeef->conf_set_int (CONFSTR_WF_BG_COLOR_G,          CONFIG_BG_COLOR.green);
     deadbeef->conf_set_int (CONFSTR_WF_BG_COLOR_B,          CONFIG_BG_COLOR.blue);
@@ -120,6 +140,16 @@ load_config (void)
     CONFIG_NUM_SAMPLES = deadbeef->conf_get_int (CONFSTR_WF_NUM_SAMPLES,              2048);
     CONFIG_CACHE_ENABLED = deadbeef->conf_get_int (CONFSTR_WF_CACHE_ENABLED,          TRUE);
     CONFIG_SCROLL_ENABLED = deadbeef->conf_get_int (CONFSTR_WF_SCROLL_ENABLED,        TRUE);
+    CONFIG_PARALLEL_ANALYSIS = deadbeef->conf_get_int (CONFSTR_WF_PARALLEL_ANALYSIS,  TRUE);
+    CONFIG_SHARED_IMAGE_DECODE = deadbeef->conf_get_int (CONFSTR_WF_SHARED_IMAGE_DECODE, TRUE);
+    CONFIG_ANALYSIS_THREADS = deadbeef->conf_get_int (CONFSTR_WF_ANALYSIS_THREADS,       2);
+    CONFIG_PREFETCH_TRACKS = deadbeef->conf_get_int (CONFSTR_WF_PREFETCH_TRACKS,         2);
+    CONFIG_IDLE_SCAN = deadbeef->conf_get_int (CONFSTR_WF_IDLE_SCAN,                 FALSE);
+    CONFIG_CACHE_COMPRESSION = deadbeef->conf_get_int (CONFSTR_WF_CACHE_COMPRESSION,     1);
+    CONFIG_CACHE_BACKEND = deadbeef->conf_get_int (CONFSTR_WF_CACHE_BACKEND,             0);
+    CONFIG_CACHE_CONTENT_HASH = deadbeef->conf_get_int (CONFSTR_WF_CACHE_CONTENT_HASH,  TRUE);
+    CONFIG_CACHE_MAX_SIZE = deadbeef->conf_get_int (CONFSTR_WF_CACHE_MAX_SIZE,          0);
+    CONFIG_MEMORY_CACHE_SIZE = deadbeef->conf_get_int (CONFSTR_WF_MEMORY_CACHE_SIZE,   16);
 
     CONFIG_BG_COLOR.red = deadbeef->conf_get_int (CONFSTR_WF_BG_COLOR_R,             50000);
     CONFIG_BG_COLOR.green = deadbeef->conf_get_int (CONFSTR_WF_BG_COLOR_G,           50000);
@@ -71,11 +71,25 @@
 #define     CONFSTR_WF_CACHE_ENABLED     "waveform.cache_enabled"
 #define     CONFSTR_WF_SCROLL_ENABLED    "waveform.scroll_enabled"
 #define     CONFSTR_WF_NUM_SAMPLES       "waveform.num_samples"
+#define     CONFSTR_WF_PARALLEL_ANALYSIS "waveform.parallel_analysis"
+#define     CONFSTR_WF_SHARED_IMAGE_DECODE "waveform.shared_image_decode"
+#define     CONFSTR_WF_ANALYSIS_THREADS  "waveform.analysis_threads"
+#define     CONFSTR_WF_PREFETCH_TRACKS   "waveform.prefetch_tracks"
+#define     CONFSTR_WF_IDLE_SCAN         "waveform.idle_scan"
+#define     CONFSTR_WF_CACHE_COMPRESSION "waveform.cache_compression"
+#define     CONFSTR_WF_CACHE_BACKEND     "waveform.cache_backend"
+#define     CONFSTR_WF_CACHE_CONTENT_HASH "waveform.cache_content_hash"
+#define     CONFSTR_WF_CACHE_MAX_SIZE    "waveform.cache_max_size"
+#define     CONFSTR_WF_MEMORY_CACHE_SIZE "waveform.memory_cache_size"
 
 extern gboolean CONFIG_LOG_ENABLED;
 extern gboolean CONFIG_MIX_TO_MONO;
 extern gboolean CONFIG_CACHE_ENABLED;
 extern gboolean CONFIG_SCROLL_ENABLED;
+extern gboolean CONFIG_PARALLEL_ANALYSIS;
+extern gboolean CONFIG_SHARED_IMAGE_DECODE;
+extern gboolean CONFIG_IDLE_SCAN;
+extern gboolean CONFIG_CACHE_CONTENT_HASH;
 extern gboolean CONFIG_DISPLAY_RMS;
 extern gboolean CONFIG_DISPLAY_RULER;
 extern gboolean CONFIG_SHADE_WAVEFORM;
@@ -96,6 +110,12 @@ extern gint     CONFIG_FONT_SIZE;
 extern gint     CONFIG_MAX_FILE_LENGTH;
 extern gint     CONFIG_NUM_SAMPLES;
 extern gint     CONFIG_REFRESH_INTERVAL;
+extern gint     CONFIG_ANALYSIS_THREADS;
+extern gint     CONFIG_PREFETCH_TRACKS;
+extern gint     CONFIG_CACHE_COMPRESSION;
+extern gint     CONFIG_CACHE_BACKEND;
+extern gint     CONFIG_CACHE_MAX_SIZE;
+extern gint     CONFIG_MEMORY_CACHE_SIZE;
 
 
 void
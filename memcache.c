@@ -0,0 +1,241 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/param.h>
+
+#include "memcache.h"
+
+typedef struct memcache_entry_s
+{
+    char *key;
+    short *data;
+    int data_len;
+    int channels;
+    waveform_pyramid_t *pyramid;
+    waveform_fingerprint_t fingerprint;
+    size_t bytes;
+    struct memcache_entry_s *prev;
+    struct memcache_entry_s *next;
+} memcache_entry_t;
+
+static pthread_mutex_t memcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+// most recently used first, only a handful of entries fit into any sane
+// budget so lookups simply walk the list
+static memcache_entry_t *memcache_head;
+static memcache_entry_t *memcache_tail;
+static size_t memcache_bytes = 0;
+static size_t memcache_budget = 0;
+
+static void
+waveform_memcache_unlink (memcache_entry_t *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    }
+    else {
+        memcache_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    }
+    else {
+        memcache_tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void
+waveform_memcache_link_front (memcache_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = memcache_head;
+    if (memcache_head) {
+        memcache_head->prev = e;
+    }
+    else {
+        memcache_tail = e;
+    }
+    memcache_head = e;
+}
+
+static void
+waveform_memcache_entry_free (memcache_entry_t *e)
+{
+    free (e->key);
+    free (e->data);
+    waveform_pyramid_free (e->pyramid);
+    free (e);
+}
+
+static void
+waveform_memcache_drop (memcache_entry_t *e)
+{
+    waveform_memcache_unlink (e);
+    memcache_bytes -= e->bytes;
+    waveform_memcache_entry_free (e);
+}
+
+// Call with memcache_mutex held.
+static memcache_entry_t *
+waveform_memcache_find (const char *key)
+{
+    for (memcache_entry_t *e = memcache_head; e; e = e->next) {
+        if (!strcmp (e->key, key)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// Call with memcache_mutex held.
+static void
+waveform_memcache_shrink (size_t budget)
+{
+    while (memcache_tail && memcache_bytes > budget) {
+        waveform_memcache_drop (memcache_tail);
+    }
+}
+
+void
+waveform_memcache_set_budget (size_t bytes)
+{
+    pthread_mutex_lock (&memcache_mutex);
+    memcache_budget = bytes;
+    waveform_memcache_shrink (memcache_budget);
+    pthread_mutex_unlock (&memcache_mutex);
+}
+
+void
+waveform_memcache_clear (void)
+{
+    pthread_mutex_lock (&memcache_mutex);
+    waveform_memcache_shrink (0);
+    pthread_mutex_unlock (&memcache_mutex);
+}
+
+int
+waveform_memcache_get (const char *key, short *buffer, int buffer_len, int *channels, waveform_pyramid_t *pyramid)
+{
+    int n = 0;
+    pthread_mutex_lock (&memcache_mutex);
+    memcache_entry_t *e = waveform_memcache_find (key);
+    if (e && e->data_len <= buffer_len) {
+        if (!pyramid || waveform_pyramid_copy (pyramid, e->pyramid)) {
+            memcpy (buffer, e->data, e->data_len * sizeof (short));
+            *channels = e->channels;
+            n = e->data_len;
+            waveform_memcache_unlink (e);
+            waveform_memcache_link_front (e);
+        }
+    }
+    pthread_mutex_unlock (&memcache_mutex);
+    return n;
+}
+
+void
+waveform_memcache_put (const char *key,
+                       const short *data,
+                       int data_len,
+                       int channels,
+                       const waveform_pyramid_t *pyramid,
+                       const waveform_fingerprint_t *fingerprint)
+{
+    if (memcache_budget == 0 || data_len <= 0) {
+        return;
+    }
+    memcache_entry_t *e = calloc (1, sizeof (memcache_entry_t));
+    if (!e) {
+        return;
+    }
+    e->key = strdup (key);
+    e->data = malloc (data_len * sizeof (short));
+    e->pyramid = waveform_pyramid_new ();
+    if (!e->key || !e->data || !e->pyramid) {
+        waveform_memcache_entry_free (e);
+        return;
+    }
+    memcpy (e->data, data, data_len * sizeof (short));
+    e->data_len = data_len;
+    e->channels = channels;
+    if (pyramid) {
+        if (!waveform_pyramid_copy (e->pyramid, pyramid)) {
+            waveform_memcache_entry_free (e);
+            return;
+        }
+    }
+    else {
+        waveform_pyramid_build (e->pyramid, data, data_len, channels);
+    }
+    if (fingerprint) {
+        e->fingerprint = *fingerprint;
+    }
+    e->bytes = sizeof (memcache_entry_t) + strlen (key) + 1 + data_len * sizeof (short) + waveform_pyramid_bytes (e->pyramid);
+
+    pthread_mutex_lock (&memcache_mutex);
+    memcache_entry_t *old = waveform_memcache_find (key);
+    if (old) {
+        waveform_memcache_drop (old);
+    }
+    if (e->bytes <= memcache_budget) {
+        waveform_memcache_shrink (memcache_budget - e->bytes);
+        waveform_memcache_link_front (e);
+        memcache_bytes += e->bytes;
+        e = NULL;
+    }
+    pthread_mutex_unlock (&memcache_mutex);
+    if (e) {
+        waveform_memcache_entry_free (e);
+    }
+}
+
+int
+waveform_memcache_fingerprint (const char *key, waveform_fingerprint_t *fingerprint)
+{
+    pthread_mutex_lock (&memcache_mutex);
+    memcache_entry_t *e = waveform_memcache_find (key);
+    if (e) {
+        *fingerprint = e->fingerprint;
+    }
+    pthread_mutex_unlock (&memcache_mutex);
+    return e != NULL;
+}
+
+void
+waveform_memcache_fingerprint_update (const char *key, const waveform_fingerprint_t *fingerprint)
+{
+    pthread_mutex_lock (&memcache_mutex);
+    memcache_entry_t *e = waveform_memcache_find (key);
+    if (e) {
+        e->fingerprint = *fingerprint;
+    }
+    pthread_mutex_unlock (&memcache_mutex);
+}
+
+void
+waveform_memcache_remove (const char *key)
+{
+    pthread_mutex_lock (&memcache_mutex);
+    memcache_entry_t *e = waveform_memcache_find (key);
+    if (e) {
+        waveform_memcache_drop (e);
+    }
+    pthread_mutex_unlock (&memcache_mutex);
+}
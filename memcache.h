@@ -0,0 +1,59 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include "cache.h"
+#include "pyramid.h"
+
+// Least recently used set of decoded waveforms and their pyramids, kept in
+// front of the cache database. All calls are thread safe.
+
+// Limits the memory held by entries, 0 disables the cache and frees them.
+void
+waveform_memcache_set_budget (size_t bytes);
+
+void
+waveform_memcache_clear (void);
+
+// Copies the entry of key into buffer and pyramid (if not NULL). Returns the
+// number of shorts copied, 0 if key isn't cached.
+int
+waveform_memcache_get (const char *key, short *buffer, int buffer_len, int *channels, waveform_pyramid_t *pyramid);
+
+// Stores a copy of data. The pyramid is built from data if it is NULL.
+void
+waveform_memcache_put (const char *key,
+                       const short *data,
+                       int data_len,
+                       int channels,
+                       const waveform_pyramid_t *pyramid,
+                       const waveform_fingerprint_t *fingerprint);
+
+// Fills the fingerprint the entry was stored with, returns 0 if key isn't
+// cached.
+int
+waveform_memcache_fingerprint (const char *key, waveform_fingerprint_t *fingerprint);
+
+void
+waveform_memcache_fingerprint_update (const char *key, const waveform_fingerprint_t *fingerprint);
+
+void
+waveform_memcache_remove (const char *key);
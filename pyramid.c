@@ -0,0 +1,184 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "pyramid.h"
+
+waveform_pyramid_t *
+waveform_pyramid_new (void)
+{
+    return calloc (1, sizeof (waveform_pyramid_t));
+}
+
+void
+waveform_pyramid_free (waveform_pyramid_t *pyramid)
+{
+    if (!pyramid) {
+        return;
+    }
+    for (int level = 0; level < PYRAMID_MAX_LEVELS; level++) {
+        if (pyramid->levels[level]) {
+            free (pyramid->levels[level]);
+            pyramid->levels[level] = NULL;
+        }
+    }
+    free (pyramid);
+}
+
+static pyramid_value_t *
+waveform_pyramid_level_reserve (waveform_pyramid_t *pyramid, int level, int size)
+{
+    if (pyramid->capacity[level] < size) {
+        pyramid_value_t *values = realloc (pyramid->levels[level], size * sizeof (pyramid_value_t));
+        if (!values) {
+            return NULL;
+        }
+        pyramid->levels[level] = values;
+        pyramid->capacity[level] = size;
+    }
+    return pyramid->levels[level];
+}
+
+void
+waveform_pyramid_build (waveform_pyramid_t *pyramid, const short *data, int data_len, int channels)
+{
+    pyramid->channels = 0;
+    pyramid->num_samples = 0;
+    pyramid->num_levels = 0;
+    if (channels <= 0 || data_len <= 0) {
+        return;
+    }
+
+    const int num_samples = data_len / (3 * channels);
+    pyramid_value_t *base = waveform_pyramid_level_reserve (pyramid, 0, num_samples * channels);
+    if (!base) {
+        return;
+    }
+    for (int i = 0; i < num_samples * channels; i++) {
+        const float rms = (float)data[3*i+2]/1000;
+        base[i].max = (float)data[3*i]/1000;
+        base[i].min = (float)data[3*i+1]/1000;
+        base[i].sum_sq = rms * rms;
+    }
+
+    int num_levels = 1;
+    int level_samples = num_samples;
+    while (level_samples > 1 && num_levels < PYRAMID_MAX_LEVELS) {
+        const int next_samples = (level_samples + 1) / 2;
+        pyramid_value_t *next = waveform_pyramid_level_reserve (pyramid, num_levels, next_samples * channels);
+        if (!next) {
+            break;
+        }
+        const pyramid_value_t *prev = pyramid->levels[num_levels - 1];
+        for (int i = 0; i < next_samples; i++) {
+            const int left = 2 * i;
+            const int right = MIN (2 * i + 1, level_samples - 1);
+            for (int ch = 0; ch < channels; ch++) {
+                const pyramid_value_t *a = &prev[left * channels + ch];
+                pyramid_value_t *out = &next[i * channels + ch];
+                *out = *a;
+                if (right != left) {
+                    const pyramid_value_t *b = &prev[right * channels + ch];
+                    out->max = MAX (a->max, b->max);
+                    out->min = MIN (a->min, b->min);
+                    out->sum_sq = a->sum_sq + b->sum_sq;
+                }
+            }
+        }
+        level_samples = next_samples;
+        num_levels++;
+    }
+
+    pyramid->channels = channels;
+    pyramid->num_samples = num_samples;
+    pyramid->num_levels = num_levels;
+}
+
+static int
+waveform_pyramid_level_size (const waveform_pyramid_t *pyramid, int level)
+{
+    return ((pyramid->num_samples + (1 << level) - 1) >> level) * pyramid->channels;
+}
+
+int
+waveform_pyramid_copy (waveform_pyramid_t *dst, const waveform_pyramid_t *src)
+{
+    dst->channels = 0;
+    dst->num_samples = 0;
+    dst->num_levels = 0;
+    for (int level = 0; level < src->num_levels; level++) {
+        const int size = waveform_pyramid_level_size (src, level);
+        pyramid_value_t *values = waveform_pyramid_level_reserve (dst, level, size);
+        if (!values) {
+            return 0;
+        }
+        memcpy (values, src->levels[level], size * sizeof (pyramid_value_t));
+    }
+    dst->channels = src->channels;
+    dst->num_samples = src->num_samples;
+    dst->num_levels = src->num_levels;
+    return 1;
+}
+
+size_t
+waveform_pyramid_bytes (const waveform_pyramid_t *pyramid)
+{
+    size_t bytes = 0;
+    for (int level = 0; level < pyramid->num_levels; level++) {
+        bytes += waveform_pyramid_level_size (pyramid, level) * sizeof (pyramid_value_t);
+    }
+    return bytes;
+}
+
+int
+waveform_pyramid_reduce (const waveform_pyramid_t *pyramid,
+                         int channel,
+                         int start,
+                         int end,
+                         float *max,
+                         float *min,
+                         float *sum_sq)
+{
+    *max = -1.0;
+    *min = 1.0;
+    *sum_sq = 0.0;
+
+    start = MAX (start, 0);
+    end = MIN (end, pyramid->num_samples);
+    const int count = end - start;
+
+    // walk the range in the largest aligned blocks available
+    while (start < end) {
+        int level = 0;
+        while (level + 1 < pyramid->num_levels
+               && (start & ((2 << level) - 1)) == 0
+               && start + (2 << level) <= end) {
+            level++;
+        }
+        const pyramid_value_t *v = &pyramid->levels[level][(start >> level) * pyramid->channels + channel];
+        *max = MAX (*max, v->max);
+        *min = MIN (*min, v->min);
+        *sum_sq += v->sum_sq;
+        start += 1 << level;
+    }
+    return MAX (count, 0);
+}
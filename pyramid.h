@@ -0,0 +1,73 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+// Power-of-two min/max/sum-of-squares levels over the stored waveform so
+// that any range of samples can be reduced by touching O(log n) values.
+#define PYRAMID_MAX_LEVELS (20)
+
+typedef struct
+{
+    float max;
+    float min;
+    float sum_sq;
+} pyramid_value_t;
+
+typedef struct waveform_pyramid_s
+{
+    int channels;
+    // samples per channel of level 0
+    int num_samples;
+    int num_levels;
+    // level k holds ceil (num_samples / 2^k) * channels values, interleaved
+    // by channel
+    pyramid_value_t *levels[PYRAMID_MAX_LEVELS];
+    int capacity[PYRAMID_MAX_LEVELS];
+} waveform_pyramid_t;
+
+waveform_pyramid_t *
+waveform_pyramid_new (void);
+
+void
+waveform_pyramid_free (waveform_pyramid_t *pyramid);
+
+// Rebuilds all levels from the stored (max, min, rms) * 1000 shorts.
+void
+waveform_pyramid_build (waveform_pyramid_t *pyramid, const short *data, int data_len, int channels);
+
+// Makes dst hold the same levels as src. Returns 0 on allocation failure.
+int
+waveform_pyramid_copy (waveform_pyramid_t *dst, const waveform_pyramid_t *src);
+
+// Memory used by the levels in use.
+size_t
+waveform_pyramid_bytes (const waveform_pyramid_t *pyramid);
+
+// Reduces the level 0 samples [start, end) of channel into max, min and the
+// sum of squared rms values. Returns the number of samples covered.
+int
+waveform_pyramid_reduce (const waveform_pyramid_t *pyramid,
+                         int channel,
+                         int start,
+                         int end,
+                         float *max,
+                         float *min,
+                         float *sum_sq);
@@ -0,0 +1,356 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/param.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define REDUCE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "reduce.h"
+
+// the vector kernels keep one accumulator per channel and vector, channel
+// counts above this are handled by the scalar kernel
+#define REDUCE_SIMD_MAX_CHANNELS (8)
+
+static void
+reduce_init_values (int channels, float *min, float *max, float *sum_sq)
+{
+    for (int ch = 0; ch < channels; ch++) {
+        min[ch] = 1.0;
+        max[ch] = -1.0;
+        sum_sq[ch] = 0.0;
+    }
+}
+
+// Reduces the interleaved values [start, end) into min/max/sum_sq. start has
+// to point to the first channel of a frame.
+static void
+reduce_scalar_range (const float *data, int start, int end, int channels, float *min, float *max, float *sum_sq)
+{
+    int ch = 0;
+    for (int i = start; i < end; i++) {
+        const float sample_val = data[i];
+        max[ch] = MAX (max[ch], sample_val);
+        min[ch] = MIN (min[ch], sample_val);
+        sum_sq[ch] += sample_val * sample_val;
+        if (++ch == channels) {
+            ch = 0;
+        }
+    }
+}
+
+static void
+reduce_scalar (const float *data, int frames, int channels, float *min, float *max, float *sum_sq)
+{
+    reduce_init_values (channels, min, max, sum_sq);
+    reduce_scalar_range (data, 0, frames * channels, channels, min, max, sum_sq);
+}
+
+// Integer kernels convert each value as it is read, so no float copy of the
+// block is ever written.
+static inline float
+pcm_s16_value (const int16_t *data, int i)
+{
+    return data[i] / (float)0x8000;
+}
+
+static inline float
+pcm_s24_value (const uint8_t *data, int i)
+{
+    const uint8_t *p = data + i * 3;
+    const int32_t v = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+    return v / (float)0x800000;
+}
+
+static inline float
+pcm_s32_value (const int32_t *data, int i)
+{
+    return data[i] / (float)0x80000000u;
+}
+
+#define REDUCE_PCM_SCALAR(name, type)                                                      \
+static void                                                                                \
+reduce_##name##_range (const type *data, int start, int end, int channels,                 \
+                       float *min, float *max, float *sum_sq)                              \
+{                                                                                          \
+    int ch = 0;                                                                            \
+    for (int i = start; i < end; i++) {                                                    \
+        const float sample_val = pcm_##name##_value (data, i);                             \
+        max[ch] = MAX (max[ch], sample_val);                                               \
+        min[ch] = MIN (min[ch], sample_val);                                               \
+        sum_sq[ch] += sample_val * sample_val;                                             \
+        if (++ch == channels) {                                                            \
+            ch = 0;                                                                        \
+        }                                                                                  \
+    }                                                                                      \
+}                                                                                          \
+                                                                                           \
+static void                                                                                \
+reduce_##name (const void *data, int frames, int channels,                                 \
+               float *min, float *max, float *sum_sq)                                      \
+{                                                                                          \
+    reduce_init_values (channels, min, max, sum_sq);                                       \
+    reduce_##name##_range (data, 0, frames * channels, channels, min, max, sum_sq);        \
+}
+
+REDUCE_PCM_SCALAR (s16, int16_t)
+REDUCE_PCM_SCALAR (s24, uint8_t)
+REDUCE_PCM_SCALAR (s32, int32_t)
+
+typedef void (*reduce_pcm_func_t)(const void *data,
+                                  int frames,
+                                  int channels,
+                                  float *min,
+                                  float *max,
+                                  float *sum_sq);
+
+#ifdef REDUCE_X86
+// Both vector kernels walk the buffer in blocks of `channels` vectors. Lane j
+// of accumulator k then always holds channel (k * width + j) % channels, so
+// the interleaved data never has to be shuffled inside the loop.
+static void
+reduce_fold_lanes (const float *lanes_min,
+                   const float *lanes_max,
+                   const float *lanes_sum,
+                   int lanes,
+                   int channels,
+                   float *min,
+                   float *max,
+                   float *sum_sq)
+{
+    for (int i = 0; i < lanes; i++) {
+        const int ch = i % channels;
+        min[ch] = MIN (min[ch], lanes_min[i]);
+        max[ch] = MAX (max[ch], lanes_max[i]);
+        sum_sq[ch] += lanes_sum[i];
+    }
+}
+
+__attribute__((target("sse2")))
+static void
+reduce_sse2 (const float *data, int frames, int channels, float *min, float *max, float *sum_sq)
+{
+    enum { WIDTH = 4 };
+    __m128 vmin[REDUCE_SIMD_MAX_CHANNELS];
+    __m128 vmax[REDUCE_SIMD_MAX_CHANNELS];
+    __m128 vsum[REDUCE_SIMD_MAX_CHANNELS];
+
+    for (int k = 0; k < channels; k++) {
+        vmin[k] = _mm_set1_ps (1.0f);
+        vmax[k] = _mm_set1_ps (-1.0f);
+        vsum[k] = _mm_setzero_ps ();
+    }
+
+    const int total = frames * channels;
+    const int block = channels * WIDTH;
+    int i = 0;
+    for (; i + block <= total; i += block) {
+        for (int k = 0; k < channels; k++) {
+            const __m128 v = _mm_loadu_ps (data + i + k * WIDTH);
+            vmin[k] = _mm_min_ps (vmin[k], v);
+            vmax[k] = _mm_max_ps (vmax[k], v);
+            vsum[k] = _mm_add_ps (vsum[k], _mm_mul_ps (v, v));
+        }
+    }
+
+    float lanes_min[REDUCE_SIMD_MAX_CHANNELS * WIDTH];
+    float lanes_max[REDUCE_SIMD_MAX_CHANNELS * WIDTH];
+    float lanes_sum[REDUCE_SIMD_MAX_CHANNELS * WIDTH];
+    for (int k = 0; k < channels; k++) {
+        _mm_storeu_ps (lanes_min + k * WIDTH, vmin[k]);
+        _mm_storeu_ps (lanes_max + k * WIDTH, vmax[k]);
+        _mm_storeu_ps (lanes_sum + k * WIDTH, vsum[k]);
+    }
+
+    reduce_init_values (channels, min, max, sum_sq);
+    reduce_fold_lanes (lanes_min, lanes_max, lanes_sum, block, channels, min, max, sum_sq);
+    reduce_scalar_range (data, i, total, channels, min, max, sum_sq);
+}
+
+__attribute__((target("avx")))
+static void
+reduce_avx (const float *data, int frames, int channels, float *min, float *max, float *sum_sq)
+{
+    enum { WIDTH = 8 };
+    __m256 vmin[REDUCE_SIMD_MAX_CHANNELS];
+    __m256 vmax[REDUCE_SIMD_MAX_CHANNELS];
+    __m256 vsum[REDUCE_SIMD_MAX_CHANNELS];
+
+    for (int k = 0; k < channels; k++) {
+        vmin[k] = _mm256_set1_ps (1.0f);
+        vmax[k] = _mm256_set1_ps (-1.0f);
+        vsum[k] = _mm256_setzero_ps ();
+    }
+
+    const int total = frames * channels;
+    const int block = channels * WIDTH;
+    int i = 0;
+    for (; i + block <= total; i += block) {
+        for (int k = 0; k < channels; k++) {
+            const __m256 v = _mm256_loadu_ps (data + i + k * WIDTH);
+            vmin[k] = _mm256_min_ps (vmin[k], v);
+            vmax[k] = _mm256_max_ps (vmax[k], v);
+            vsum[k] = _mm256_add_ps (vsum[k], _mm256_mul_ps (v, v));
+        }
+    }
+
+    float lanes_min[REDUCE_SIMD_MAX_CHANNELS * WIDTH];
+    float lanes_max[REDUCE_SIMD_MAX_CHANNELS * WIDTH];
+    float lanes_sum[REDUCE_SIMD_MAX_CHANNELS * WIDTH];
+    for (int k = 0; k < channels; k++) {
+        _mm256_storeu_ps (lanes_min + k * WIDTH, vmin[k]);
+        _mm256_storeu_ps (lanes_max + k * WIDTH, vmax[k]);
+        _mm256_storeu_ps (lanes_sum + k * WIDTH, vsum[k]);
+    }
+    _mm256_zeroupper ();
+
+    reduce_init_values (channels, min, max, sum_sq);
+    reduce_fold_lanes (lanes_min, lanes_max, lanes_sum, block, channels, min, max, sum_sq);
+    reduce_scalar_range (data, i, total, channels, min, max, sum_sq);
+}
+
+// 16 bit samples are by far the most common integer format, they get the
+// float kernel's layout with the widening done in registers.
+__attribute__((target("sse2")))
+static void
+reduce_s16_sse2 (const void *samples, int frames, int channels, float *min, float *max, float *sum_sq)
+{
+    enum { WIDTH = 4 };
+    const int16_t *data = samples;
+    __m128 vmin[REDUCE_SIMD_MAX_CHANNELS];
+    __m128 vmax[REDUCE_SIMD_MAX_CHANNELS];
+    __m128 vsum[REDUCE_SIMD_MAX_CHANNELS];
+    const __m128 scale = _mm_set1_ps (1.0f / 0x8000);
+
+    for (int k = 0; k < channels; k++) {
+        vmin[k] = _mm_set1_ps (1.0f);
+        vmax[k] = _mm_set1_ps (-1.0f);
+        vsum[k] = _mm_setzero_ps ();
+    }
+
+    const int total = frames * channels;
+    const int block = channels * WIDTH;
+    int i = 0;
+    for (; i + block <= total; i += block) {
+        for (int k = 0; k < channels; k++) {
+            const __m128i s = _mm_loadl_epi64 ((const __m128i *)(data + i + k * WIDTH));
+            const __m128i s32 = _mm_srai_epi32 (_mm_unpacklo_epi16 (s, s), 16);
+            const __m128 v = _mm_mul_ps (_mm_cvtepi32_ps (s32), scale);
+            vmin[k] = _mm_min_ps (vmin[k], v);
+            vmax[k] = _mm_max_ps (vmax[k], v);
+            vsum[k] = _mm_add_ps (vsum[k], _mm_mul_ps (v, v));
+        }
+    }
+
+    float lanes_min[REDUCE_SIMD_MAX_CHANNELS * WIDTH];
+    float lanes_max[REDUCE_SIMD_MAX_CHANNELS * WIDTH];
+    float lanes_sum[REDUCE_SIMD_MAX_CHANNELS * WIDTH];
+    for (int k = 0; k < channels; k++) {
+        _mm_storeu_ps (lanes_min + k * WIDTH, vmin[k]);
+        _mm_storeu_ps (lanes_max + k * WIDTH, vmax[k]);
+        _mm_storeu_ps (lanes_sum + k * WIDTH, vsum[k]);
+    }
+
+    reduce_init_values (channels, min, max, sum_sq);
+    reduce_fold_lanes (lanes_min, lanes_max, lanes_sum, block, channels, min, max, sum_sq);
+    reduce_s16_range (data, i, total, channels, min, max, sum_sq);
+}
+#endif
+
+static waveform_reduce_func_t reduce_simd = reduce_scalar;
+static reduce_pcm_func_t reduce_s16_simd = reduce_s16;
+
+void
+waveform_reduce_init (void)
+{
+#ifdef REDUCE_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx")) {
+        reduce_simd = reduce_avx;
+    }
+    else if (__builtin_cpu_supports ("sse2")) {
+        reduce_simd = reduce_sse2;
+    }
+    if (__builtin_cpu_supports ("sse2")) {
+        reduce_s16_simd = reduce_s16_sse2;
+    }
+#endif
+}
+
+void
+waveform_reduce (const float *data, int frames, int channels, float *min, float *max, float *sum_sq)
+{
+    if (channels > REDUCE_SIMD_MAX_CHANNELS) {
+        reduce_scalar (data, frames, channels, min, max, sum_sq);
+        return;
+    }
+    reduce_simd (data, frames, channels, min, max, sum_sq);
+}
+
+waveform_pcm_t
+waveform_pcm_format (int bps, int is_float, int is_bigendian)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (is_bigendian) {
+        return WAVEFORM_PCM_NONE;
+    }
+    if (is_float) {
+        return bps == 32 ? WAVEFORM_PCM_FLOAT32 : WAVEFORM_PCM_NONE;
+    }
+    switch (bps) {
+    case 16:
+        return WAVEFORM_PCM_S16;
+    case 24:
+        return WAVEFORM_PCM_S24;
+    case 32:
+        return WAVEFORM_PCM_S32;
+    }
+#endif
+    return WAVEFORM_PCM_NONE;
+}
+
+void
+waveform_reduce_pcm (const void *data, int frames, int channels, waveform_pcm_t format, float *min, float *max, float *sum_sq)
+{
+    switch (format) {
+    case WAVEFORM_PCM_FLOAT32:
+        waveform_reduce (data, frames, channels, min, max, sum_sq);
+        break;
+    case WAVEFORM_PCM_S16:
+        if (channels > REDUCE_SIMD_MAX_CHANNELS) {
+            reduce_s16 (data, frames, channels, min, max, sum_sq);
+        }
+        else {
+            reduce_s16_simd (data, frames, channels, min, max, sum_sq);
+        }
+        break;
+    case WAVEFORM_PCM_S24:
+        reduce_s24 (data, frames, channels, min, max, sum_sq);
+        break;
+    case WAVEFORM_PCM_S32:
+        reduce_s32 (data, frames, channels, min, max, sum_sq);
+        break;
+    default:
+        reduce_init_values (channels, min, max, sum_sq);
+        break;
+    }
+}
@@ -0,0 +1,56 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+// Computes min, max and sum of squares of every channel of an interleaved
+// float buffer in a single pass. min/max/sum_sq hold one value per channel.
+typedef void (*waveform_reduce_func_t)(const float *data,
+                                       int frames,
+                                       int channels,
+                                       float *min,
+                                       float *max,
+                                       float *sum_sq);
+
+// Picks the fastest kernel supported by the running cpu.
+void
+waveform_reduce_init (void);
+
+void
+waveform_reduce (const float *data, int frames, int channels, float *min, float *max, float *sum_sq);
+
+// Sample formats which are reduced straight from the decoder output, without
+// a conversion to float beforehand.
+typedef enum
+{
+    WAVEFORM_PCM_NONE,
+    WAVEFORM_PCM_FLOAT32,
+    WAVEFORM_PCM_S16,
+    WAVEFORM_PCM_S24,
+    WAVEFORM_PCM_S32,
+} waveform_pcm_t;
+
+// Returns WAVEFORM_PCM_NONE for formats which have to go through
+// pcm_convert first.
+waveform_pcm_t
+waveform_pcm_format (int bps, int is_float, int is_bigendian);
+
+// Same as waveform_reduce for interleaved samples in the given format,
+// scaled to [-1, 1] the way pcm_convert does it.
+void
+waveform_reduce_pcm (const void *data, int frames, int channels, waveform_pcm_t format, float *min, float *max, float *sum_sq);
@@ -19,6 +19,7 @@
 */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <sys/param.h>
 #include <math.h>
@@ -28,24 +29,108 @@
 #include "render.h"
 #include "waveform.h"
 #include "config.h"
+#include "pyramid.h"
 
 #define LINE_WIDTH_DEFAULT (1.0)
 #define LINE_WIDTH_BARS (1.0)
 #define VALUES_PER_SAMPLE (3)
+// entries of the log scale lookup table
+#define LOG_LUT_SIZE (1024)
+// magnitude of the first entry after 0
+#define LOG_LUT_FIRST (1.f / (LOG_LUT_SIZE * LOG_LUT_SIZE))
 #define W_COLOR(X) (X)->r, (X)->g, (X)->b, (X)->a
 
-typedef struct
-{
-    double x;
-    double y;
-} waveform_point_t;
-
 typedef struct
 {
     double x1, y1;
     double x2, y2;
 } waveform_line_t;
 
+/* copied from ardour3 */
+static inline float
+_log_meter (float power, double lower_db, double upper_db, double non_linearity)
+{
+    return (power < lower_db ? 0.0 : pow ((power - lower_db) / (upper_db - lower_db), non_linearity));
+}
+
+static inline float
+alt_log_meter (float power)
+{
+    return _log_meter (power, -192.0, 0.0, 8.0);
+}
+
+static inline float
+coefficient_to_dB (float coeff)
+{
+    return 20.0f * log10 (coeff);
+}
+/* end of ardour copy */
+
+// Exact mapping, the lookup table is built from it.
+static inline float
+sample_log_scale (float sample)
+{
+    float sample_log = 0.0;
+    if (sample > 0.0) {
+        sample_log = alt_log_meter (coefficient_to_dB (sample));
+    }
+    else {
+        sample_log = -alt_log_meter (coefficient_to_dB (-sample));
+    }
+
+    return sample_log;
+}
+
+// Log scaled magnitudes, indexed by the square root of the magnitude. The
+// steep part of the curve close to 0 gets most of the entries that way, the
+// linear interpolation between them stays below 1e-4 at 1024 entries from
+// the first entry on.
+static float log_lut[LOG_LUT_SIZE + 1];
+static bool log_lut_ready = false;
+
+static void
+log_lut_init (void)
+{
+    for (int i = 0; i <= LOG_LUT_SIZE; i++) {
+        const float u = (float)i / LOG_LUT_SIZE;
+        log_lut[i] = sample_log_scale (u * u);
+    }
+    log_lut_ready = true;
+}
+
+static inline float
+sample_log_scale_lut (float sample)
+{
+    const float a = fabsf (sample);
+    if (a >= 1.f || a < LOG_LUT_FIRST) {
+        // clipped peaks and near silence are rare enough to be mapped
+        // exactly, the curve is too steep below the first entry
+        return sample_log_scale (sample);
+    }
+    const float pos = sqrtf (a) * LOG_LUT_SIZE;
+    // sqrtf rounds magnitudes just below 1 up to 1
+    const int i = MIN ((int)pos, LOG_LUT_SIZE - 1);
+    const float value = log_lut[i] + (log_lut[i + 1] - log_lut[i]) * (pos - i);
+    return sample < 0.f ? -value : value;
+}
+
+// Maps all columns to the log scale at once, before any path is built.
+static void
+waveform_data_render_log_scale (waveform_data_render_t *w_render_ctx)
+{
+    if (!log_lut_ready) {
+        log_lut_init ();
+    }
+    const int plane = w_render_ctx->num_channels * w_render_ctx->num_samples;
+    const int stride = w_render_ctx->capacity_samples;
+    for (int p = 0; p < 3; p++) {
+        float *values = w_render_ctx->block + p * stride;
+        for (int i = 0; i < plane; i++) {
+            values[i] = sample_log_scale_lut (values[i]);
+        }
+    }
+}
+
 void
 waveform_data_render_free (waveform_data_render_t *w_render_ctx)
 {
@@ -53,16 +138,13 @@ waveform_data_render_free (waveform_data_render_t *w_render_ctx)
         return;
     }
 
-    if (w_render_ctx->samples) {
-        for (int ch = 0; ch < w_render_ctx->num_channels; ch++) {
-            waveform_sample_t *samples = w_render_ctx->samples[ch];
-            if (samples) {
-                free (samples);
-                w_render_ctx->samples[ch] = NULL;
-            }
-        }
-        free (w_render_ctx->samples);
-        w_render_ctx->samples = NULL;
+    if (w_render_ctx->columns) {
+        free (w_render_ctx->columns);
+        w_render_ctx->columns = NULL;
+    }
+    if (w_render_ctx->block) {
+        free (w_render_ctx->block);
+        w_render_ctx->block = NULL;
     }
     free (w_render_ctx);
     w_render_ctx = NULL;
@@ -71,270 +153,254 @@ waveform_data_render_free (waveform_data_render_t *w_render_ctx)
 }
 
 waveform_data_render_t *
-waveform_data_render_new (int channels, int width)
+waveform_data_render_new (void)
 {
-    if (channels <= 0) {
-        return NULL;
-    }
-
     waveform_data_render_t *w_render_ctx = calloc (1, sizeof (waveform_data_render_t));
     assert (w_render_ctx != NULL);
-
-    w_render_ctx->samples = calloc (channels, sizeof (waveform_sample_t *));
-    assert (w_render_ctx->samples != NULL);
-
-    for (int ch = 0; ch < channels; ch++) {
-        w_render_ctx->samples[ch] = calloc (width, sizeof (waveform_sample_t));
-        assert (w_render_ctx->samples[ch] != NULL);
-    }
-
-    w_render_ctx->num_channels = channels;
-    w_render_ctx->num_samples = width;
-
     return w_render_ctx;
 }
 
+// Makes room for channels rows of width columns. Returns 0 if that fails,
+// w_render_ctx keeps its previous buffers then.
 static int
-waveform_data_render_build_sample (wavedata_t *wave_data,
-                                   waveform_sample_t *sample,
-                                   int sample_size,
-                                   int channel,
-                                   double start,
-                                   double end)
+waveform_data_render_reserve (waveform_data_render_t *w_render_ctx, int channels, int width)
 {
-    const int ch_offset = channel * VALUES_PER_SAMPLE;
-
-    float min = 1.0;
-    float max = -1.0;
-    float rms = 0.0;
-
-    const int s_end = floorf (sample_size * end);
-
-    int counter = 0;
-    for (int i = start; i < end; i++) {
-        for (int pos = i * sample_size; pos < s_end; pos += sample_size, counter++) {
-            int index = pos + ch_offset;
-            float s_max = (float)wave_data->data[index]/1000;
-            float s_min = (float)wave_data->data[index+1]/1000;
-            float s_rms = (float)wave_data->data[index+2]/1000;
-            max = MAX (max, s_max);
-            min = MIN (min, s_min);
-            rms += s_rms * s_rms;
+    if (channels > w_render_ctx->capacity_channels) {
+        waveform_columns_t *columns = realloc (w_render_ctx->columns, channels * sizeof (waveform_columns_t));
+        if (!columns) {
+            return 0;
         }
+        w_render_ctx->columns = columns;
+        w_render_ctx->capacity_channels = channels;
     }
-
-    sample->max = max;
-    sample->min = min;
-    sample->rms = rms;
-
-    return counter;
+    if (channels * width > w_render_ctx->capacity_samples) {
+        // contents are rebuilt anyway, no need to copy them over
+        float *block = malloc (3 * channels * width * sizeof (float));
+        if (!block) {
+            return 0;
+        }
+        free (w_render_ctx->block);
+        w_render_ctx->block = block;
+        w_render_ctx->capacity_samples = channels * width;
+    }
+    const int stride = w_render_ctx->capacity_samples;
+    for (int ch = 0; ch < channels; ch++) {
+        float *first = w_render_ctx->block + ch * width;
+        w_render_ctx->columns[ch].max = first;
+        w_render_ctx->columns[ch].min = first + stride;
+        w_render_ctx->columns[ch].rms = first + 2 * stride;
+    }
+    w_render_ctx->num_channels = channels;
+    w_render_ctx->num_samples = width;
+    return 1;
 }
 
-waveform_data_render_t *
-waveform_render_data_build (wavedata_t *wave_data, int width, bool downmix_mono)
+int
+waveform_render_data_build (waveform_data_render_t *w_render_ctx, wavedata_t *wave_data, int width, bool downmix_mono, float start, float end)
 {
     const int channels_data = wave_data->channels;
-    if (channels_data <= 0) {
-        return NULL;
+    const waveform_pyramid_t *pyramid = wave_data->pyramid;
+    if (width <= 0 || channels_data <= 0 || !pyramid || pyramid->num_samples <= 0 || pyramid->channels != channels_data) {
+        return 0;
     }
 
     const int channels_render = CONFIG_MIX_TO_MONO ? 1 : channels_data;
-    const int sample_size = VALUES_PER_SAMPLE * channels_data;
-    const float num_samples_per_x = wave_data->data_len / (float)(width * sample_size);
+    const int num_samples = pyramid->num_samples;
+    const float first_sample = MIN (MAX (start, 0.f), 1.f) * num_samples;
+    const float num_samples_per_x = (MIN (MAX (end, start), 1.f) * num_samples - first_sample) / width;
 
-    waveform_data_render_t *w_render_ctx = waveform_data_render_new (channels_render, width);
+    if (!waveform_data_render_reserve (w_render_ctx, channels_render, width)) {
+        return 0;
+    }
 
     for (int ch = 0; ch < w_render_ctx->num_channels; ch++) {
-        waveform_sample_t *samples = w_render_ctx->samples[ch];
-
-        int d_start = 0;
+        waveform_columns_t *columns = &w_render_ctx->columns[ch];
 
         for (int x = 0; x < width; x++) {
-            const int d_end = MAX (floorf ((x+1) * num_samples_per_x),1);
-            waveform_sample_t *sample = &samples[x];
-
-            int counter = 0;
-            if (CONFIG_MIX_TO_MONO) {
-                for (int ch_data = 0; ch_data < channels_data; ch_data++) {
-                    counter += waveform_data_render_build_sample (wave_data,
-                                                                 sample,
-                                                                 sample_size,
-                                                                 ch_data,
-                                                                 d_start,
-                                                                 d_end);
-                }
-            }
-            else {
-                counter += waveform_data_render_build_sample (wave_data,
-                                                             sample,
-                                                             sample_size,
-                                                             ch,
-                                                             d_start,
-                                                             d_end);
+            int d_start = floorf (first_sample + x * num_samples_per_x);
+            int d_end = MIN (floorf (first_sample + (x+1) * num_samples_per_x), num_samples);
+            if (d_end <= d_start) {
+                // more pixels than samples, repeat the current one
+                d_start = MIN (d_start, num_samples - 1);
+                d_end = d_start + 1;
             }
+            float max = -1.0;
+            float min = 1.0;
+            float rms = 0.0;
+            int counter = 0;
 
-            sample->rms /= counter;
-            sample->rms = sqrt (sample->rms);
+            const int ch_first = CONFIG_MIX_TO_MONO ? 0 : ch;
+            const int ch_last = CONFIG_MIX_TO_MONO ? channels_data : ch + 1;
+            for (int ch_data = ch_first; ch_data < ch_last; ch_data++) {
+                float s_max, s_min, s_sum_sq;
+                counter += waveform_pyramid_reduce (pyramid, ch_data, d_start, d_end, &s_max, &s_min, &s_sum_sq);
+                max = MAX (max, s_max);
+                min = MIN (min, s_min);
+                rms += s_sum_sq;
+            }
 
-            d_start = d_end;
+            columns->max[x] = max;
+            columns->min[x] = min;
+            columns->rms[x] = counter > 0 ? sqrt (rms / counter) : 0.0;
         }
     }
 
-    return w_render_ctx;
-}
-
-enum SAMPLE_TYPE {
-    SAMPLE_MAX,
-    SAMPLE_MIN,
-    SAMPLE_RMS_MAX,
-    SAMPLE_RMS_MIN,
-    N_SAMPLE_TYPES
-};
-
-typedef void (*waveform_render_sample_func)(cairo_t *cr_ctx,
-                                            waveform_sample_t *sample,
-                                            waveform_point_t *point,
-                                            double y_scale_1,
-                                            double y_scale_2);
-
-/* copied from ardour3 */
-static inline float
-_log_meter (float power, double lower_db, double upper_db, double non_linearity)
-{
-    return (power < lower_db ? 0.0 : pow ((power - lower_db) / (upper_db - lower_db), non_linearity));
-}
+    if (CONFIG_LOG_ENABLED) {
+        waveform_data_render_log_scale (w_render_ctx);
+    }
 
-static inline float
-alt_log_meter (float power)
-{
-    return _log_meter (power, -192.0, 0.0, 8.0);
+    return 1;
 }
 
-static inline float
-coefficient_to_dB (float coeff)
-{
-    return 20.0f * log10 (coeff);
-}
-/* end of ardour copy */
+enum SAMPLE_GROUPS {
+    SAMPLE_MIN_MAX,
+    SAMPLE_RMS_MIN_MAX,
+    N_SAMPLE_GROUPS,
+};
 
-static inline float
-sample_log_scale (float sample)
+// Picks the values outlining a group. Values above the center line come
+// from upper, the ones below from lower times lower_sign.
+static void
+waveform_columns_select (const waveform_columns_t *columns,
+                         int type,
+                         const float **upper,
+                         const float **lower,
+                         double *lower_sign)
 {
-    float sample_log = 0.0;
-    if (sample > 0.0) {
-        sample_log = alt_log_meter (coefficient_to_dB (sample));
+    if (type == SAMPLE_RMS_MIN_MAX) {
+        *upper = columns->rms;
+        *lower = columns->rms;
+        *lower_sign = -1.0;
     }
     else {
-        sample_log = -alt_log_meter (coefficient_to_dB (-sample));
+        *upper = columns->max;
+        *lower = columns->min;
+        *lower_sign = 1.0;
     }
-
-    return sample_log;
 }
 
-static float
-sample_value_scale (float value, float scale, bool log_scale)
+// Pixels of an RGB24 image surface which cr draws on without scaling.
+typedef struct
 {
-    if (log_scale) {
-        value = sample_log_scale (value);
-    }
+    cairo_surface_t *target;
+    uint32_t *pixels;
+    // in pixels
+    int stride;
+    int width;
+    int height;
+    // device position of the user space origin
+    int x0;
+    int y0;
+} waveform_raster_t;
+
+// Source color of one surface row, premultiplied with its 8 bit alpha.
+typedef struct
+{
+    uint32_t r, g, b;
+    uint32_t inv_alpha;
+} waveform_raster_color_t;
 
-    return value * scale;
-}
+// one entry per surface row, only used from the gui thread
+static waveform_raster_color_t *raster_rows = NULL;
+static int raster_rows_len = 0;
 
-static void
-waveform_render_samples_loop_reverse (cairo_t *cr_ctx,
-                                      waveform_sample_t *samples,
-                                      waveform_render_sample_func *render_sample,
-                                      double y_scale_1,
-                                      double y_scale_2,
-                                      double x_start,
-                                      double y_start,
-                                      double width)
+static bool
+waveform_raster_get (cairo_t *cr_ctx, waveform_raster_t *raster)
 {
-    if (!render_sample) {
-        return;
+    cairo_surface_t *target = cairo_get_target (cr_ctx);
+    if (cairo_surface_get_type (target) != CAIRO_SURFACE_TYPE_IMAGE
+        || cairo_image_surface_get_format (target) != CAIRO_FORMAT_RGB24) {
+        return false;
     }
-
-    const int width_i = floor (width) - 1;
-
-    for (int x = width_i; x >= x_start; x--) {
-        waveform_sample_t *sample = &samples[x];
-        waveform_point_t point = {x, y_start};
-
-        (*render_sample)(cr_ctx, sample, &point, y_scale_1, y_scale_2);
+    cairo_matrix_t m;
+    cairo_get_matrix (cr_ctx, &m);
+    if (m.xx != 1.0 || m.yy != 1.0 || m.xy != 0.0 || m.yx != 0.0 || m.x0 != floor (m.x0) || m.y0 != floor (m.y0)) {
+        return false;
     }
-}
-
-static void
-waveform_render_samples_loop (cairo_t *cr_ctx,
-                              waveform_sample_t *samples,
-                              waveform_render_sample_func *render_sample,
-                              double y_scale_1,
-                              double y_scale_2,
-                              double x_start,
-                              double y_start,
-                              double width)
-{
-    if (!render_sample) {
-        return;
+    cairo_surface_flush (target);
+    raster->target = target;
+    raster->pixels = (uint32_t *)cairo_image_surface_get_data (target);
+    raster->stride = cairo_image_surface_get_stride (target) / sizeof (uint32_t);
+    raster->width = cairo_image_surface_get_width (target);
+    raster->height = cairo_image_surface_get_height (target);
+    raster->x0 = (int)m.x0;
+    raster->y0 = (int)m.y0;
+    if (!raster->pixels || raster->height <= 0) {
+        return false;
     }
-
-    const int width_i = floor (width);
-
-    for (int x = 0; x < width_i; x++) {
-        waveform_sample_t *sample = &samples[x];
-        waveform_point_t point = {x_start + x, y_start};
-
-        (*render_sample)(cr_ctx, sample, &point, y_scale_1, y_scale_2);
+    if (raster->height > raster_rows_len) {
+        waveform_raster_color_t *rows = realloc (raster_rows, raster->height * sizeof (waveform_raster_color_t));
+        if (!rows) {
+            return false;
+        }
+        raster_rows = rows;
+        raster_rows_len = raster->height;
     }
+    return true;
 }
 
-static void inline
-waveform_render_bars_sample_generic (cairo_t *cr_ctx,
-                                     double s1,
-                                     double s2,
-                                     waveform_point_t *point,
-                                     double y_scale_1,
-                                     double y_scale_2)
+// Fills the color of every surface row. The soundcloud gradient only varies
+// the alpha from row to row.
+static void
+waveform_raster_rows_fill (waveform_raster_t *raster, const color_t *color, const waveform_rect_t *rect, bool soundcloud)
 {
-    const double x = point->x;
-    const double y = point->y;
-    const double y_1 = y - sample_value_scale (s1, y_scale_1, CONFIG_LOG_ENABLED);
-    const double y_2 = y - sample_value_scale (s2, y_scale_2, CONFIG_LOG_ENABLED);
-
-    cairo_move_to (cr_ctx, x, y_1);
-    cairo_line_to (cr_ctx, x, y_2);
+    for (int row = 0; row < raster->height; row++) {
+        double alpha = color->a;
+        if (soundcloud) {
+            // same stops as waveform_render_soundcloud_pattern_get
+            double t = rect->height > 0 ? (row - raster->y0 + 0.5 - rect->y) / rect->height : 0.0;
+            t = MIN (MAX (t, 0.0), 1.0);
+            alpha = t < 0.7 ? 0.7 + 0.3 * t / 0.7 : 0.5;
+        }
+        const uint32_t a = (uint32_t)(MIN (MAX (alpha, 0.0), 1.0) * 256.0 + 0.5);
+        waveform_raster_color_t *c = &raster_rows[row];
+        c->r = (uint32_t)(MIN (MAX (color->r, 0.0), 1.0) * 255.0 + 0.5) * a;
+        c->g = (uint32_t)(MIN (MAX (color->g, 0.0), 1.0) * 255.0 + 0.5) * a;
+        c->b = (uint32_t)(MIN (MAX (color->b, 0.0), 1.0) * 255.0 + 0.5) * a;
+        c->inv_alpha = 256 - a;
+    }
 }
 
-static void
-waveform_render_bars_sample_minmax (cairo_t *cr_ctx,
-                                    waveform_sample_t *sample,
-                                    waveform_point_t *point,
-                                    double y_scale_1,
-                                    double y_scale_2)
+// Blends the rows [y_from, y_to) of pixel column x over the surface.
+static inline void
+waveform_raster_span (waveform_raster_t *raster, int x, int y_from, int y_to)
 {
-    waveform_render_bars_sample_generic (cr_ctx,
-                                         sample->max,
-                                         sample->min,
-                                         point,
-                                         y_scale_1,
-                                         y_scale_2);
+    uint32_t *p = raster->pixels + (size_t)y_from * raster->stride + x;
+    for (int row = y_from; row < y_to; row++, p += raster->stride) {
+        const waveform_raster_color_t *c = &raster_rows[row];
+        const uint32_t d = *p;
+        const uint32_t r = (c->r + ((d >> 16) & 0xff) * c->inv_alpha) >> 8;
+        const uint32_t g = (c->g + ((d >> 8) & 0xff) * c->inv_alpha) >> 8;
+        const uint32_t b = (c->b + (d & 0xff) * c->inv_alpha) >> 8;
+        *p = (r << 16) | (g << 8) | b;
+    }
 }
 
+// Rasterizes one bar per column the way a 1px wide, non antialiased stroke
+// from the upper to the lower value would cover the pixels, without building
+// a path.
 static void
-waveform_render_bars_sample_rms (cairo_t *cr_ctx,
-                                 waveform_sample_t *sample,
-                                 waveform_point_t *point,
-                                 double y_scale_1,
-                                 double y_scale_2)
+waveform_raster_bars (waveform_raster_t *raster,
+                      const float *upper,
+                      const float *lower,
+                      double y_scale_1,
+                      double y_scale_2,
+                      double x_start,
+                      double y_center,
+                      int width)
 {
-    waveform_render_bars_sample_generic (cr_ctx,
-                                         sample->rms,
-                                         -sample->rms,
-                                         point,
-                                         y_scale_1,
-                                         y_scale_2);
-
+    const int x_first = raster->x0 + (int)floor (x_start);
+    const int x_begin = MAX (0, -x_first);
+    const int x_end = MIN (width, raster->width - x_first);
+    for (int x = x_begin; x < x_end; x++) {
+        const double y_1 = y_center - upper[x] * y_scale_1;
+        const double y_2 = y_center - lower[x] * y_scale_2;
+        const int y_from = MAX ((int)floor (MIN (y_1, y_2) + 0.5) + raster->y0, 0);
+        const int y_to = MIN ((int)floor (MAX (y_1, y_2) + 0.5) + raster->y0, raster->height);
+        if (y_from < y_to) {
+            waveform_raster_span (raster, x_first + x, y_from, y_to);
+        }
+    }
 }
 
 static cairo_pattern_t *
@@ -357,15 +423,16 @@ waveform_render_soundcloud_pattern_get (cairo_t *cr_ctx,
 
 static void
 waveform_render_wave_bar_values (cairo_t *cr_ctx,
-                                 waveform_sample_t *samples,
+                                 const waveform_columns_t *columns,
                                  waveform_colors_t *color,
+                                 const color_t *source,
                                  int type,
                                  waveform_rect_t *rect)
 {
     double x = rect->x;
     double y = rect->y;
-    double width = rect->width;
     double height = rect->height;
+    const int width = floor (rect->width);
 
     double y_scale_1 = 0.5 * height;
     if (CONFIG_SOUNDCLOUD_STYLE) {
@@ -375,18 +442,19 @@ waveform_render_wave_bar_values (cairo_t *cr_ctx,
 
     double y_center = y_scale_1 + y;
 
-    cairo_move_to (cr_ctx, x, y_center);
-
-    waveform_render_sample_func render_func = NULL;
-    switch (type) {
-        case SAMPLE_RMS_MAX:
-        case SAMPLE_RMS_MIN:
-            render_func = &waveform_render_bars_sample_rms;
-            break;
-        case SAMPLE_MAX:
-        case SAMPLE_MIN:
-            render_func = &waveform_render_bars_sample_minmax;
-            break;
+    const float *upper;
+    const float *lower;
+    double lower_sign;
+    waveform_columns_select (columns, type, &upper, &lower, &lower_sign);
+    y_scale_2 *= lower_sign;
+
+    // image surfaces get their bars written directly
+    waveform_raster_t raster;
+    if (waveform_raster_get (cr_ctx, &raster)) {
+        waveform_raster_rows_fill (&raster, CONFIG_SOUNDCLOUD_STYLE ? &color->fg : source, rect, CONFIG_SOUNDCLOUD_STYLE);
+        waveform_raster_bars (&raster, upper, lower, y_scale_1, y_scale_2, x, y_center, width);
+        cairo_surface_mark_dirty (raster.target);
+        return;
     }
 
     cairo_pattern_t *lin_pat = NULL;
@@ -402,14 +470,11 @@ waveform_render_wave_bar_values (cairo_t *cr_ctx,
                                                           &vec_pat);
     }
 
-    waveform_render_samples_loop (cr_ctx,
-                                  samples,
-                                  &render_func,
-                                  y_scale_1,
-                                  y_scale_2,
-                                  x,
-                                  y_center,
-                                  width);
+    cairo_move_to (cr_ctx, x, y_center);
+    for (int i = 0; i < width; i++) {
+        cairo_move_to (cr_ctx, x + i, y_center - upper[i] * y_scale_1);
+        cairo_line_to (cr_ctx, x + i, y_center - lower[i] * y_scale_2);
+    }
     cairo_stroke (cr_ctx);
 
     if (lin_pat) {
@@ -419,7 +484,7 @@ waveform_render_wave_bar_values (cairo_t *cr_ctx,
 }
 
 void
-waveform_draw_wave_bars (waveform_sample_t *samples,
+waveform_draw_wave_bars (const waveform_columns_t *columns,
                          waveform_colors_t *colors,
                          cairo_t *cr_ctx,
                          waveform_rect_t *rect)
@@ -430,120 +495,42 @@ waveform_draw_wave_bars (waveform_sample_t *samples,
 
     // draw min/max values
     waveform_render_wave_bar_values (cr_ctx,
-                                     samples,
+                                     columns,
                                      colors,
-                                     SAMPLE_MAX,
+                                     &colors->fg,
+                                     SAMPLE_MIN_MAX,
                                      rect);
 
     if (CONFIG_DISPLAY_RMS) {
         // draw rms values
         cairo_set_source_rgba (cr_ctx, W_COLOR (&colors->rms));
         waveform_render_wave_bar_values (cr_ctx,
-                                         samples,
+                                         columns,
                                          colors,
-                                         SAMPLE_RMS_MAX,
+                                         &colors->rms,
+                                         SAMPLE_RMS_MIN_MAX,
                                          rect);
     }
 
     return;
 }
 
-static void
-waveform_render_default_sample_generic (cairo_t *cr_ctx,
-                                        double sample,
-                                        waveform_point_t *point,
-                                        double y_scale)
-{
-    const double x = point->x;
-    const double y = point->y - sample_value_scale (sample, y_scale, CONFIG_LOG_ENABLED);
-    cairo_line_to (cr_ctx, x, y);
-}
-
-static void
-waveform_render_default_sample_max (cairo_t *cr_ctx,
-                                    waveform_sample_t *sample,
-                                    waveform_point_t *point,
-                                    double y_scale_1,
-                                    double y_scale_2)
-{
-    waveform_render_default_sample_generic (cr_ctx,
-                                            sample->max,
-                                            point,
-                                            y_scale_1);
-}
-
-static void
-waveform_render_default_sample_min (cairo_t *cr_ctx,
-                                    waveform_sample_t *sample,
-                                    waveform_point_t *point,
-                                    double y_scale_1,
-                                    double y_scale_2)
-{
-    waveform_render_default_sample_generic (cr_ctx,
-                                            sample->min,
-                                            point,
-                                            y_scale_1);
-}
-
-static void
-waveform_render_default_sample_rms1 (cairo_t *cr_ctx,
-                                     waveform_sample_t *sample,
-                                     waveform_point_t *point,
-                                     double y_scale_1,
-                                     double y_scale_2)
-{
-    waveform_render_default_sample_generic (cr_ctx,
-                                            sample->rms,
-                                            point,
-                                            y_scale_1);
-}
-
-static void
-waveform_render_default_sample_rms2 (cairo_t *cr_ctx,
-                                     waveform_sample_t *sample,
-                                     waveform_point_t *point,
-                                     double y_scale_1,
-                                     double y_scale_2)
-{
-    waveform_render_default_sample_generic (cr_ctx,
-                                            -sample->rms,
-                                            point,
-                                            y_scale_1);
-}
-
-enum SAMPLE_GROUPS {
-    SAMPLE_MIN_MAX,
-    SAMPLE_RMS_MIN_MAX,
-    N_SAMPLE_GROUPS,
-};
-
 static void
 waveform_render_wave_default_values (cairo_t *cr_ctx,
-                                     waveform_sample_t *samples,
+                                     const waveform_columns_t *columns,
                                      waveform_colors_t *color,
                                      int type,
                                      waveform_rect_t *rect)
 {
     double x = rect->x;
     double y = rect->y;
-    double width = rect->width;
     double height = rect->height;
+    const int width = floor (rect->width);
 
-    waveform_render_sample_func render_func_1;
-    waveform_render_sample_func render_func_2;
-
-    switch (type) {
-        case SAMPLE_MIN_MAX:
-            render_func_1 = waveform_render_default_sample_max;
-            render_func_2= waveform_render_default_sample_min;
-            break;
-        case SAMPLE_RMS_MIN_MAX:
-            render_func_1= waveform_render_default_sample_rms1;
-            render_func_2= waveform_render_default_sample_rms2;
-            break;
-        default:
-            return;
-    }
+    const float *upper;
+    const float *lower;
+    double lower_sign;
+    waveform_columns_select (columns, type, &upper, &lower, &lower_sign);
 
     double y_scale = 0.5 * height;
     double y_center = y_scale + y;
@@ -563,26 +550,17 @@ waveform_render_wave_default_values (cairo_t *cr_ctx,
         lin_pat = waveform_render_soundcloud_pattern_get (cr_ctx, color, &vec_pat);
     }
 
+    // along the upper values to the right, back along the lower ones
     cairo_move_to (cr_ctx, x, y_center);
-    waveform_render_samples_loop (cr_ctx,
-                                  samples,
-                                  &render_func_1,
-                                  y_scale,
-                                  y_scale,
-                                  x,
-                                  y_center,
-                                  width);
-
-    y_scale = height - y_scale;
-
-    waveform_render_samples_loop_reverse (cr_ctx,
-                                          samples,
-                                          &render_func_2,
-                                          y_scale,
-                                          y_scale,
-                                          x,
-                                          y_center,
-                                          width);
+    for (int i = 0; i < width; i++) {
+        cairo_line_to (cr_ctx, x + i, y_center - upper[i] * y_scale);
+    }
+
+    y_scale = (height - y_scale) * lower_sign;
+
+    for (int i = width - 1; i >= 0; i--) {
+        cairo_line_to (cr_ctx, x + i, y_center - lower[i] * y_scale);
+    }
     if (!CONFIG_FILL_WAVEFORM) {
         cairo_stroke (cr_ctx);
     }
@@ -599,7 +577,7 @@ waveform_render_wave_default_values (cairo_t *cr_ctx,
 }
 
 void
-waveform_draw_wave_default (waveform_sample_t *samples,
+waveform_draw_wave_default (const waveform_columns_t *columns,
                             waveform_colors_t *colors,
                             cairo_t *cr_ctx,
                             waveform_rect_t *rect)
@@ -609,7 +587,7 @@ waveform_draw_wave_default (waveform_sample_t *samples,
     cairo_set_source_rgba (cr_ctx, W_COLOR (&colors->fg));
 
     waveform_render_wave_default_values (cr_ctx,
-                                         samples,
+                                         columns,
                                          colors,
                                          SAMPLE_MIN_MAX,
                                          rect);
@@ -618,7 +596,7 @@ waveform_draw_wave_default (waveform_sample_t *samples,
         cairo_set_source_rgba (cr_ctx, W_COLOR (&colors->rms));
 
         waveform_render_wave_default_values (cr_ctx,
-                                             samples,
+                                             columns,
                                              colors,
                                              SAMPLE_RMS_MIN_MAX,
                                              rect);
@@ -626,4 +604,3 @@ waveform_draw_wave_default (waveform_sample_t *samples,
 
     return;
 }
-
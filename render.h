@@ -23,33 +23,49 @@
 #include <stdbool.h>
 #include "waveform.h"
 
+// Columns of one channel, every value kind in an array of its own so whole
+// rows can be scaled in one go.
 typedef struct {
-    float max;
-    float min;
-    float rms;
-} waveform_sample_t;
+    float *max;
+    float *min;
+    float *rms;
+} waveform_columns_t;
 
+// Render data is kept across redraws, its block only gets reallocated when a
+// frame needs more columns or channels than it holds.
 typedef struct {
-    waveform_sample_t **samples;
+    // one entry per channel, pointing into block
+    waveform_columns_t *columns;
     int num_channels;
     // samples per channel
     int num_samples;
+    // allocated channel entries and columns of all channels
+    int capacity_channels;
+    int capacity_samples;
+    // planes of capacity_samples max, min and rms values
+    float *block;
 } waveform_data_render_t;
 
+waveform_data_render_t *
+waveform_data_render_new (void);
+
 void
 waveform_data_render_free (waveform_data_render_t *w_render_ctx);
 
-waveform_data_render_t *
-waveform_render_data_build (wavedata_t *wave_data, int width, bool downmix_mono);
+// Fills w_render_ctx with width columns from the part of wave_data between
+// the fractions start and end of its length (0 and 1 for the whole
+// waveform). Returns 0 if there is nothing to render.
+int
+waveform_render_data_build (waveform_data_render_t *w_render_ctx, wavedata_t *wave_data, int width, bool downmix_mono, float start, float end);
 
 void
-waveform_draw_wave_default (waveform_sample_t *samples,
+waveform_draw_wave_default (const waveform_columns_t *columns,
                             waveform_colors_t *colors,
                             cairo_t *cr_ctx,
                             waveform_rect_t *rect);
 
 void
-waveform_draw_wave_bars (waveform_sample_t *samples,
+waveform_draw_wave_bars (const waveform_columns_t *columns,
                          waveform_colors_t *colors,
                          cairo_t *cr_ctx,
                          waveform_rect_t *rect);
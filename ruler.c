@@ -312,6 +312,7 @@ ruler_sub_marker_draw (cairo_t *cr_ctx,
 void
 waveform_render_ruler (cairo_t *cr_ctx,
                        waveform_colors_t *color,
+                       float offset,
                        float duration,
                        waveform_rect_t *rect)
 {
@@ -357,8 +358,10 @@ waveform_render_ruler (cairo_t *cr_ctx,
     const double center_abs = rect->height/2.0;
     const double y = center + ruler_text_height_get (cr_ctx)/2.0;
 
-    double x = rect->x;
-    for (int i = 1; i <= res->n; i++) {
+    // start at the last marker left of the visible range
+    const int i_first = floorf (MAX (offset, 0.f) / res->value.value);
+    double x = rect->x - (offset - i_first * res->value.value)/duration * rect->width;
+    for (int i = i_first + 1; i * res->value.value - offset <= duration; i++) {
         // Draw sub time markers
         //
         //     |
@@ -25,6 +25,7 @@
 
 #include "waveform.h"
 
+// Draws the time markers of the range [offset, offset + duration].
 void
-waveform_render_ruler (cairo_t *cr_ctx, waveform_colors_t *color, float duration, waveform_rect_t *rect);
+waveform_render_ruler (cairo_t *cr_ctx, waveform_colors_t *color, float offset, float duration, waveform_rect_t *rect);
 
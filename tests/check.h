@@ -0,0 +1,69 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Helpers shared by the standalone checks. Every check is a program of its
+// own which exits with a non-zero status if anything failed.
+
+static int check_failures = 0;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf (stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond);         \
+            fprintf (stderr, __VA_ARGS__);                                      \
+            fprintf (stderr, "\n");                                             \
+            check_failures++;                                                   \
+        }                                                                       \
+    } while (0)
+
+static inline int
+check_done (const char *name)
+{
+    if (check_failures) {
+        fprintf (stderr, "%s: %d check(s) failed\n", name, check_failures);
+        return 1;
+    }
+    printf ("%s: ok\n", name);
+    return 0;
+}
+
+// xorshift32, so that a failing check fails the same way on every run
+static uint32_t check_rand_state = 2463534242u;
+
+static inline uint32_t
+check_rand (void)
+{
+    uint32_t x = check_rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return check_rand_state = x;
+}
+
+// Uniform in [lo, hi].
+static inline int
+check_rand_range (int lo, int hi)
+{
+    return lo + (int)(check_rand () % (uint32_t)((int64_t)hi - lo + 1));
+}
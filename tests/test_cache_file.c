@@ -0,0 +1,201 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Index probing, growth and eviction of the file backend in a temporary
+// directory.
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "check.h"
+// the index and the record layout are static
+#include "../cache_file.c"
+
+#define NUM_KEYS (3000)
+#define DATA_BYTES (256)
+#define NUM_RECENT (10)
+
+static void
+make_key (char *key, size_t size, int i)
+{
+    snprintf (key, size, "/music/album %d/track %d.flac", i / 10, i);
+}
+
+static void
+make_data (unsigned char *data, int i)
+{
+    for (int j = 0; j < DATA_BYTES; j++) {
+        data[j] = (unsigned char)(i * 31 + j);
+    }
+}
+
+// Looks up key i and compares it with what was written for it.
+static int
+check_key (int i)
+{
+    char key[100];
+    unsigned char data[DATA_BYTES];
+    make_key (key, sizeof (key), i);
+    make_data (data, i);
+
+    int channels = 0, compression = 0, bytes = 0;
+    waveform_fingerprint_t fingerprint = { 0 };
+    waveform_db_info_t info = { 0 };
+    waveform_file_lock ();
+    const void *stored = waveform_file_lookup (key, &channels, &compression, &bytes, &fingerprint, &info);
+    int found = stored != NULL;
+    if (stored) {
+        CHECK (bytes == DATA_BYTES && memcmp (stored, data, DATA_BYTES) == 0, "%s: data differs", key);
+        CHECK (channels == 1 + i % 2, "%s: %d channels", key, channels);
+        CHECK (compression == i % 3, "%s: compression %d", key, compression);
+        CHECK (fingerprint.size == i * 1000 && fingerprint.mtime == i, "%s: fingerprint differs", key);
+        CHECK (info.samples == 2048 && info.samplerate == 44100, "%s: info differs", key);
+    }
+    waveform_file_unlock ();
+    return found;
+}
+
+static int
+write_key (int i)
+{
+    char key[100];
+    unsigned char data[DATA_BYTES];
+    make_key (key, sizeof (key), i);
+    make_data (data, i);
+    const waveform_fingerprint_t fingerprint = { .size = i * 1000, .mtime = i, .content_hash = 0 };
+    const waveform_db_info_t info = { .samples = 2048, .samplerate = 44100, .duration = i };
+    return waveform_file_write (key, data, DATA_BYTES, 1 + i % 2, i % 3, &fingerprint, &info);
+}
+
+static void
+check_write_lookup (void)
+{
+    for (int i = 0; i < NUM_KEYS; i++) {
+        CHECK (write_key (i) == 0, "write %d failed", i);
+    }
+    // more keys than half of the initial index
+    CHECK (index_map->capacity > INDEX_MIN_CAPACITY, "index not grown, capacity %llu",
+           (unsigned long long)index_map->capacity);
+    for (int i = 0; i < NUM_KEYS; i++) {
+        CHECK (check_key (i), "key %d lost", i);
+    }
+
+    int channels, compression, bytes;
+    waveform_file_lock ();
+    CHECK (waveform_file_lookup ("/music/missing.flac", &channels, &compression, &bytes, NULL, NULL) == NULL,
+           "missing key found");
+    waveform_file_unlock ();
+
+    // rewriting a key replaces it
+    CHECK (write_key (7) == 0, "rewrite failed");
+    CHECK (check_key (7), "rewritten key lost");
+
+    char key[100];
+    make_key (key, sizeof (key), 5);
+    waveform_file_delete (key);
+    CHECK (!check_key (5), "deleted key found");
+    CHECK (waveform_file_touch (key) != 0, "deleted key touched");
+    CHECK (write_key (5) == 0 && check_key (5), "deleted key not written again");
+
+    make_key (key, sizeof (key), 3);
+    const waveform_fingerprint_t fingerprint = { .size = 1, .mtime = 2, .content_hash = 3 };
+    CHECK (waveform_file_fingerprint_set (key, &fingerprint) == 0, "fingerprint_set failed");
+    waveform_fingerprint_t stored = { 0 };
+    waveform_file_lock ();
+    CHECK (waveform_file_lookup (key, &channels, &compression, &bytes, &stored, NULL) != NULL, "key 3 lost");
+    waveform_file_unlock ();
+    CHECK (stored.size == 1 && stored.mtime == 2 && stored.content_hash == 3, "fingerprint not updated");
+    // back to what check_key expects
+    write_key (3);
+}
+
+// Moves the access time of key i into the future, touch only has a
+// resolution of seconds.
+static void
+make_recent (int i)
+{
+    char key[100];
+    make_key (key, sizeof (key), i);
+    CHECK (waveform_file_touch (key) == 0, "touch %d failed", i);
+    index_entry_t *e = waveform_file_probe (key, waveform_file_hash (key), 0);
+    const uint32_t later = time (NULL) + 3600;
+    CHECK (pwrite (data_fd, &later, sizeof (later), e->offset + offsetof (record_header_t, accessed)) == sizeof (later),
+           "access time of %d not set", i);
+}
+
+static void
+check_evict (void)
+{
+    for (int i = 0; i < NUM_RECENT; i++) {
+        make_recent (i * 100);
+    }
+    const uint64_t before = data_end;
+    const int64_t record_size = waveform_file_record_size (strlen ("/music/album 100/track 1000.flac"), DATA_BYTES);
+    const int64_t max_bytes = 100 * record_size;
+    CHECK (waveform_file_evict (max_bytes) == 0, "evict failed");
+    CHECK (data_end < before && (int64_t)data_end <= max_bytes, "data file still %llu bytes",
+           (unsigned long long)data_end);
+
+    int kept = 0;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        kept += check_key (i);
+    }
+    const int64_t min_record_size = waveform_file_record_size (strlen ("/music/album 0/track 0.flac"), DATA_BYTES);
+    CHECK (kept > NUM_RECENT && kept <= max_bytes / 4 * 3 / min_record_size, "%d keys kept", kept);
+    CHECK (kept == (int)index_map->used, "%d keys kept, %llu indexed", kept, (unsigned long long)index_map->used);
+    for (int i = 0; i < NUM_RECENT; i++) {
+        CHECK (check_key (i * 100), "recent key %d evicted", i * 100);
+    }
+
+    // a file that fits already is left alone
+    const uint64_t after = data_end;
+    CHECK (waveform_file_evict (max_bytes) == 0 && data_end == after, "evicted again");
+    CHECK (write_key (1) == 0 && check_key (1), "write after evict failed");
+}
+
+int
+main (void)
+{
+    char dir[] = "/tmp/waveform-check-XXXXXX";
+    if (!mkdtemp (dir)) {
+        CHECK (0, "no temporary directory");
+        return check_done ("test_cache_file");
+    }
+    CHECK (waveform_file_open (dir) == 0, "open failed");
+    if (index_map && data_map) {
+        check_write_lookup ();
+        check_evict ();
+
+        // everything written is there after opening again
+        waveform_file_close ();
+        CHECK (waveform_file_open (dir) == 0, "reopen failed");
+        CHECK (check_key (1), "key 1 lost on reopen");
+        for (int i = 0; i < NUM_RECENT; i++) {
+            CHECK (check_key (i * 100), "recent key %d lost on reopen", i * 100);
+        }
+    }
+    waveform_file_close ();
+
+    char path[100];
+    snprintf (path, sizeof (path), "%s/wavecache.idx", dir);
+    unlink (path);
+    snprintf (path, sizeof (path), "%s/wavecache.dat", dir);
+    unlink (path);
+    rmdir (dir);
+    return check_done ("test_cache_file");
+}
@@ -0,0 +1,151 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Round trips of the cache encodings: delta/zigzag has to be exact, log8
+// has to stay within its quantization step.
+
+#include <limits.h>
+
+#include "check.h"
+// the codecs are static
+#include "../cache.c"
+
+#define NUM_VALUES (3 * 2 * 4096)
+
+static void
+check_delta (int channels, const short *data, int n)
+{
+    unsigned char *encoded = malloc (n * 3);
+    short *decoded = malloc ((n + 1) * sizeof (short));
+    if (!encoded || !decoded) {
+        CHECK (0, "out of memory");
+        goto out;
+    }
+    const size_t len = waveform_encode_delta (data, n, channels, encoded);
+    CHECK (len <= (size_t)n * 3, "%zu bytes for %d values", len, n);
+    // a longer destination must not make up values
+    const int decoded_n = waveform_decode_delta (encoded, len, channels, decoded, n + 1);
+    CHECK (decoded_n == n, "%d values decoded, %d encoded", decoded_n, n);
+    for (int i = 0; i < n && i < decoded_n; i++) {
+        if (decoded[i] != data[i]) {
+            CHECK (decoded[i] == data[i], "%d channels, value %d: %d != %d", channels, i, decoded[i], data[i]);
+            break;
+        }
+    }
+
+out:
+    free (encoded);
+    free (decoded);
+}
+
+static void
+check_delta_round_trip (void)
+{
+    static short data[NUM_VALUES];
+
+    // extremes, the largest deltas need three varint bytes
+    for (int i = 0; i < NUM_VALUES; i++) {
+        data[i] = (i / 6) % 2 ? SHRT_MIN : SHRT_MAX;
+    }
+    for (int channels = 1; channels <= 2; channels++) {
+        check_delta (channels, data, NUM_VALUES);
+    }
+
+    for (int i = 0; i < NUM_VALUES; i++) {
+        data[i] = check_rand_range (SHRT_MIN, SHRT_MAX);
+    }
+    for (int channels = 1; channels <= 4; channels++) {
+        check_delta (channels, data, NUM_VALUES - NUM_VALUES % (channels * 3));
+    }
+    check_delta (1, data, 0);
+    check_delta (1, data, 1);
+
+    // a slowly changing waveform is what the encoding is made for
+    const int channels = 2;
+    for (int i = 0; i < NUM_VALUES; i++) {
+        const int slot = i / (channels * 3);
+        data[i] = (short)(500 + 400 * sin (slot / 50.0) * ((i % 3) == 1 ? -1 : 1));
+    }
+    unsigned char *encoded = malloc (NUM_VALUES * 3);
+    if (encoded) {
+        const size_t len = waveform_encode_delta (data, NUM_VALUES, channels, encoded);
+        // one byte per delta, only the first slot starts from 0
+        CHECK (len <= NUM_VALUES + channels * 3 * 2, "smooth data takes %zu bytes", len);
+        free (encoded);
+    }
+    check_delta (channels, data, NUM_VALUES);
+}
+
+static void
+check_log8_round_trip (void)
+{
+    unsigned char encoded[1];
+    short decoded[1];
+    for (int v = -2 * LOG8_MAX_VALUE; v <= 2 * LOG8_MAX_VALUE; v++) {
+        const short value = v;
+        waveform_encode_log8 (&value, 1, encoded);
+        CHECK (waveform_decode_log8 (encoded, 1, decoded, 1) == 1, "value %d not decoded", v);
+
+        const int expected = MAX (-LOG8_MAX_VALUE, MIN (v, LOG8_MAX_VALUE));
+        // half a step of the log scale plus the rounding to an integer
+        const double half_step = exp (log (1 + LOG8_MAX_VALUE) / LOG8_STEPS / 2) - 1;
+        const double tolerance = (abs (expected) + 1) * half_step + 1;
+        CHECK (abs (decoded[0] - expected) <= tolerance, "%d decoded as %d", v, decoded[0]);
+        CHECK ((decoded[0] < 0) == (expected < 0), "%d changed sign (%d)", v, decoded[0]);
+    }
+    waveform_encode_log8 ((const short[]){ 0 }, 1, encoded);
+    waveform_decode_log8 (encoded, 1, decoded, 1);
+    CHECK (decoded[0] == 0, "silence decoded as %d", decoded[0]);
+}
+
+// The same through the entry points the cache uses.
+static void
+check_db_codec (void)
+{
+    static short data[NUM_VALUES];
+    static short decoded[NUM_VALUES];
+    for (int i = 0; i < NUM_VALUES; i++) {
+        data[i] = check_rand_range (-LOG8_MAX_VALUE, LOG8_MAX_VALUE);
+    }
+    const int compressions[] = { WAVE_COMPRESSION_NONE, WAVE_COMPRESSION_DELTA, WAVE_COMPRESSION_LOG8 };
+    for (int c = 0; c < 3; c++) {
+        int compression = compressions[c];
+        int bytes = sizeof (data);
+        unsigned char *encoded = waveform_db_encode (data, &bytes, 2, &compression);
+        CHECK (compression == compressions[c], "compression %d became %d", compressions[c], compression);
+        const void *stored = encoded ? (const void *)encoded : (const void *)data;
+        const int n = waveform_db_decode (compression, stored, bytes, 2, decoded, NUM_VALUES);
+        CHECK (n == NUM_VALUES, "compression %d: %d values", compression, n);
+        int max_error = 0;
+        for (int i = 0; i < n; i++) {
+            max_error = MAX (max_error, abs (decoded[i] - data[i]));
+        }
+        const int allowed = compression == WAVE_COMPRESSION_LOG8 ? LOG8_MAX_VALUE / 20 : 0;
+        CHECK (max_error <= allowed, "compression %d: error %d", compression, max_error);
+        free (encoded);
+    }
+}
+
+int
+main (void)
+{
+    check_delta_round_trip ();
+    check_log8_round_trip ();
+    check_db_codec ();
+    return check_done ("test_codec");
+}
@@ -0,0 +1,78 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// The log scale lookup table against the exact mapping it is built from.
+
+#include "check.h"
+// the mapping and the table are static
+#include "../render.c"
+
+// render.c reads these, the plugin gets them from config.c
+gboolean CONFIG_LOG_ENABLED = TRUE;
+gboolean CONFIG_MIX_TO_MONO = FALSE;
+gboolean CONFIG_DISPLAY_RMS = TRUE;
+gboolean CONFIG_SOUNDCLOUD_STYLE = FALSE;
+gint CONFIG_FILL_WAVEFORM = 1;
+
+// the error bound documented next to log_lut
+#define LOG_LUT_MAX_ERROR (1e-4f)
+
+static void
+check_value (float sample, float *max_error)
+{
+    const float exact = sample_log_scale (sample);
+    const float approx = sample_log_scale_lut (sample);
+    const float error = fabsf (approx - exact);
+    *max_error = MAX (*max_error, error);
+    CHECK (error <= LOG_LUT_MAX_ERROR, "%.9g maps to %.9g instead of %.9g", sample, approx, exact);
+}
+
+int
+main (void)
+{
+    log_lut_init ();
+
+    float max_error = 0.f;
+    // dense sweep over both signs, plus the table entries themselves
+    const int steps = 1 << 20;
+    for (int i = 0; i <= steps; i++) {
+        const float sample = (float)i / steps;
+        check_value (sample, &max_error);
+        check_value (-sample, &max_error);
+    }
+    for (int i = 0; i <= LOG_LUT_SIZE; i++) {
+        const float u = (float)i / LOG_LUT_SIZE;
+        check_value (u * u, &max_error);
+    }
+    // quiet samples, where the curve is steepest
+    for (int i = 1; i < 100000; i++) {
+        check_value (i * 1e-7f, &max_error);
+    }
+    // right below full scale sqrtf rounds up to the last entry
+    check_value (nextafterf (1.f, 0.f), &max_error);
+    check_value (-nextafterf (1.f, 0.f), &max_error);
+
+    // clipped values go through the exact mapping
+    const float clipped[] = { 1.f, 1.5f, -1.f, -2.f };
+    for (size_t i = 0; i < sizeof (clipped) / sizeof (clipped[0]); i++) {
+        CHECK (sample_log_scale_lut (clipped[i]) == sample_log_scale (clipped[i]), "%f", clipped[i]);
+    }
+
+    printf ("test_log_lut: max error %g\n", max_error);
+    return check_done ("test_log_lut");
+}
@@ -0,0 +1,120 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Range reductions through the pyramid against a scan of every sample.
+
+#include <math.h>
+#include <sys/param.h>
+
+#include "check.h"
+#include "../pyramid.h"
+
+#define VALUES_PER_SAMPLE (3)
+
+static void
+brute_force (const short *data, int channels, int channel, int start, int end,
+             float *max, float *min, float *sum_sq)
+{
+    *max = -1.0;
+    *min = 1.0;
+    *sum_sq = 0.0;
+    for (int i = start; i < end; i++) {
+        const short *v = data + (i * channels + channel) * VALUES_PER_SAMPLE;
+        const float rms = v[2] / 1000.f;
+        *max = MAX (*max, v[0] / 1000.f);
+        *min = MIN (*min, v[1] / 1000.f);
+        *sum_sq += rms * rms;
+    }
+}
+
+static void
+check_ranges (waveform_pyramid_t *pyramid, const short *data, int num_samples, int channels)
+{
+    const int num_ranges = 2000;
+    for (int r = 0; r < num_ranges; r++) {
+        int start = check_rand_range (0, num_samples);
+        int end = check_rand_range (0, num_samples);
+        if (r == 0) {
+            start = 0;
+            end = num_samples;
+        }
+        if (start > end) {
+            const int t = start;
+            start = end;
+            end = t;
+        }
+        const int channel = check_rand_range (0, channels - 1);
+        float max, min, sum_sq;
+        float ref_max, ref_min, ref_sum_sq;
+        const int count = waveform_pyramid_reduce (pyramid, channel, start, end, &max, &min, &sum_sq);
+        brute_force (data, channels, channel, start, end, &ref_max, &ref_min, &ref_sum_sq);
+        CHECK (count == end - start, "[%d, %d) covers %d samples", start, end, count);
+        CHECK (max == ref_max, "[%d, %d) channel %d: max %f != %f", start, end, channel, max, ref_max);
+        CHECK (min == ref_min, "[%d, %d) channel %d: min %f != %f", start, end, channel, min, ref_min);
+        CHECK (fabsf (sum_sq - ref_sum_sq) <= 1e-4f * MAX (1.f, ref_sum_sq),
+               "[%d, %d) channel %d: sum_sq %f != %f", start, end, channel, sum_sq, ref_sum_sq);
+    }
+
+    // ranges reaching past the data are clipped
+    float max, min, sum_sq;
+    CHECK (waveform_pyramid_reduce (pyramid, 0, -5, num_samples + 5, &max, &min, &sum_sq) == num_samples,
+           "clipped range");
+    CHECK (waveform_pyramid_reduce (pyramid, 0, num_samples, num_samples + 5, &max, &min, &sum_sq) == 0,
+           "range past the end");
+}
+
+int
+main (void)
+{
+    const int sample_counts[] = { 1, 2, 3, 1000, 2048, 4093 };
+    for (int channels = 1; channels <= 3; channels++) {
+        for (size_t c = 0; c < sizeof (sample_counts) / sizeof (sample_counts[0]); c++) {
+            const int num_samples = sample_counts[c];
+            const int data_len = num_samples * channels * VALUES_PER_SAMPLE;
+            short *data = malloc (data_len * sizeof (short));
+            waveform_pyramid_t *pyramid = waveform_pyramid_new ();
+            waveform_pyramid_t *copy = waveform_pyramid_new ();
+            if (!data || !pyramid || !copy) {
+                CHECK (0, "out of memory");
+                return check_done ("test_pyramid");
+            }
+            for (int i = 0; i < num_samples * channels; i++) {
+                const int a = check_rand_range (-1000, 1000);
+                const int b = check_rand_range (-1000, 1000);
+                data[3*i] = MAX (a, b);
+                data[3*i+1] = MIN (a, b);
+                data[3*i+2] = check_rand_range (0, 1000);
+            }
+
+            waveform_pyramid_build (pyramid, data, data_len, channels);
+            CHECK (pyramid->num_samples == num_samples, "%d samples built", pyramid->num_samples);
+            CHECK (pyramid->num_levels >= 1 && (num_samples >> (pyramid->num_levels - 1)) <= 1,
+                   "%d levels for %d samples", pyramid->num_levels, num_samples);
+            check_ranges (pyramid, data, num_samples, channels);
+
+            CHECK (waveform_pyramid_copy (copy, pyramid), "copy failed");
+            CHECK (waveform_pyramid_bytes (copy) == waveform_pyramid_bytes (pyramid), "copy differs in size");
+            check_ranges (copy, data, num_samples, channels);
+
+            waveform_pyramid_free (copy);
+            waveform_pyramid_free (pyramid);
+            free (data);
+        }
+    }
+    return check_done ("test_pyramid");
+}
@@ -0,0 +1,161 @@
+/*
+    Waveform seekbar plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Compares the vector kernels and the integer ingest paths against the
+// scalar float kernel.
+
+#include <math.h>
+#include <string.h>
+
+#include "check.h"
+// the kernels are static
+#include "../reduce.c"
+
+#define MAX_FRAMES (1031)
+#define MAX_TEST_CHANNELS (10)
+
+static const int frame_counts[] = { 0, 1, 3, 4, 7, 8, 9, 64, 255, MAX_FRAMES };
+
+static void
+compare (const char *what, int frames, int channels,
+         const float *min, const float *max, const float *sum_sq,
+         const float *ref_min, const float *ref_max, const float *ref_sum_sq)
+{
+    for (int ch = 0; ch < channels; ch++) {
+        CHECK (min[ch] == ref_min[ch], "%s %d frames %d channels: min[%d] %f != %f",
+               what, frames, channels, ch, min[ch], ref_min[ch]);
+        CHECK (max[ch] == ref_max[ch], "%s %d frames %d channels: max[%d] %f != %f",
+               what, frames, channels, ch, max[ch], ref_max[ch]);
+        // the vector kernels sum in a different order
+        CHECK (fabsf (sum_sq[ch] - ref_sum_sq[ch]) <= 1e-4f * MAX (1.f, ref_sum_sq[ch]),
+               "%s %d frames %d channels: sum_sq[%d] %f != %f",
+               what, frames, channels, ch, sum_sq[ch], ref_sum_sq[ch]);
+    }
+}
+
+static void
+check_float_kernels (void)
+{
+    static float data[MAX_FRAMES * MAX_TEST_CHANNELS];
+    for (int i = 0; i < MAX_FRAMES * MAX_TEST_CHANNELS; i++) {
+        data[i] = check_rand_range (-100000, 100000) / 100000.f;
+    }
+
+    waveform_reduce_init ();
+    for (int channels = 1; channels <= MAX_TEST_CHANNELS; channels++) {
+        for (size_t f = 0; f < sizeof (frame_counts) / sizeof (frame_counts[0]); f++) {
+            const int frames = frame_counts[f];
+            float ref_min[MAX_TEST_CHANNELS], ref_max[MAX_TEST_CHANNELS], ref_sum[MAX_TEST_CHANNELS];
+            float min[MAX_TEST_CHANNELS], max[MAX_TEST_CHANNELS], sum[MAX_TEST_CHANNELS];
+            reduce_scalar (data, frames, channels, ref_min, ref_max, ref_sum);
+
+            waveform_reduce (data, frames, channels, min, max, sum);
+            compare ("waveform_reduce", frames, channels, min, max, sum, ref_min, ref_max, ref_sum);
+#ifdef REDUCE_X86
+            if (channels > REDUCE_SIMD_MAX_CHANNELS) {
+                continue;
+            }
+            if (__builtin_cpu_supports ("sse2")) {
+                reduce_sse2 (data, frames, channels, min, max, sum);
+                compare ("sse2", frames, channels, min, max, sum, ref_min, ref_max, ref_sum);
+            }
+            if (__builtin_cpu_supports ("avx")) {
+                reduce_avx (data, frames, channels, min, max, sum);
+                compare ("avx", frames, channels, min, max, sum, ref_min, ref_max, ref_sum);
+            }
+#endif
+        }
+    }
+}
+
+static void
+check_pcm_format (void)
+{
+    CHECK (waveform_pcm_format (32, 1, 0) == WAVEFORM_PCM_FLOAT32, "float32");
+    CHECK (waveform_pcm_format (64, 1, 0) == WAVEFORM_PCM_NONE, "float64");
+    CHECK (waveform_pcm_format (8, 0, 0) == WAVEFORM_PCM_NONE, "s8");
+    CHECK (waveform_pcm_format (16, 0, 1) == WAVEFORM_PCM_NONE, "big endian");
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    CHECK (waveform_pcm_format (16, 0, 0) == WAVEFORM_PCM_S16, "s16");
+    CHECK (waveform_pcm_format (24, 0, 0) == WAVEFORM_PCM_S24, "s24");
+    CHECK (waveform_pcm_format (32, 0, 0) == WAVEFORM_PCM_S32, "s32");
+#endif
+}
+
+// Ingests random integer samples, the reference is the scalar float kernel
+// over the same samples converted the way pcm_convert does.
+static void
+check_pcm_kernels (void)
+{
+    static int16_t s16[MAX_FRAMES * MAX_TEST_CHANNELS];
+    static uint8_t s24[MAX_FRAMES * MAX_TEST_CHANNELS * 3];
+    static int32_t s32[MAX_FRAMES * MAX_TEST_CHANNELS];
+    static float f16[MAX_FRAMES * MAX_TEST_CHANNELS];
+    static float f24[MAX_FRAMES * MAX_TEST_CHANNELS];
+    static float f32[MAX_FRAMES * MAX_TEST_CHANNELS];
+
+    for (int i = 0; i < MAX_FRAMES * MAX_TEST_CHANNELS; i++) {
+        // full scale values in both directions are part of the data
+        const int32_t v16 = i == 0 ? -32768 : i == 1 ? 32767 : check_rand_range (-32768, 32767);
+        const int32_t v24 = i == 0 ? -8388608 : i == 1 ? 8388607 : check_rand_range (-8388608, 8388607);
+        const int32_t v32 = i == 0 ? INT32_MIN : i == 1 ? INT32_MAX : (int32_t)check_rand ();
+        s16[i] = v16;
+        s24[3*i] = v24 & 0xff;
+        s24[3*i+1] = (v24 >> 8) & 0xff;
+        s24[3*i+2] = (v24 >> 16) & 0xff;
+        s32[i] = v32;
+        f16[i] = v16 / (float)0x8000;
+        f24[i] = v24 / (float)0x800000;
+        f32[i] = v32 / (float)0x80000000u;
+    }
+
+    for (int channels = 1; channels <= MAX_TEST_CHANNELS; channels++) {
+        for (size_t f = 0; f < sizeof (frame_counts) / sizeof (frame_counts[0]); f++) {
+            const int frames = frame_counts[f];
+            float ref_min[MAX_TEST_CHANNELS], ref_max[MAX_TEST_CHANNELS], ref_sum[MAX_TEST_CHANNELS];
+            float min[MAX_TEST_CHANNELS], max[MAX_TEST_CHANNELS], sum[MAX_TEST_CHANNELS];
+
+            reduce_scalar (f16, frames, channels, ref_min, ref_max, ref_sum);
+            waveform_reduce_pcm (s16, frames, channels, WAVEFORM_PCM_S16, min, max, sum);
+            compare ("s16", frames, channels, min, max, sum, ref_min, ref_max, ref_sum);
+            reduce_s16 (s16, frames, channels, min, max, sum);
+            compare ("s16 scalar", frames, channels, min, max, sum, ref_min, ref_max, ref_sum);
+
+            reduce_scalar (f24, frames, channels, ref_min, ref_max, ref_sum);
+            waveform_reduce_pcm (s24, frames, channels, WAVEFORM_PCM_S24, min, max, sum);
+            compare ("s24", frames, channels, min, max, sum, ref_min, ref_max, ref_sum);
+
+            reduce_scalar (f32, frames, channels, ref_min, ref_max, ref_sum);
+            waveform_reduce_pcm (s32, frames, channels, WAVEFORM_PCM_S32, min, max, sum);
+            compare ("s32", frames, channels, min, max, sum, ref_min, ref_max, ref_sum);
+
+            reduce_scalar (f32, frames, channels, ref_min, ref_max, ref_sum);
+            waveform_reduce_pcm (f32, frames, channels, WAVEFORM_PCM_FLOAT32, min, max, sum);
+            compare ("float32", frames, channels, min, max, sum, ref_min, ref_max, ref_sum);
+        }
+    }
+}
+
+int
+main (void)
+{
+    check_float_kernels ();
+    check_pcm_format ();
+    check_pcm_kernels ();
+    return check_done ("test_reduce");
+}
@@ -31,6 +31,7 @@
 #include <assert.h>
 #include <math.h>
 #include <fcntl.h>
+#include <sys/param.h>
 
 #include <deadbeef/deadbeef.h>
 
@@ -81,10 +82,18 @@ void
 queue_pop (const char *fname)
 {
     deadbeef->mutex_lock (mutex);
-    cache_query_t *next = NULL;
-    for (cache_query_t *q = queue; q; q = q->next) {
+    cache_query_t *prev = NULL;
+    for (cache_query_t *q = queue; q; prev = q, q = q->next) {
         if (!strcmp (fname, q->fname)) {
-            next = q->next;
+            if (prev) {
+                prev->next = q->next;
+            }
+            else {
+                queue = q->next;
+            }
+            if (queue_tail == q) {
+                queue_tail = prev;
+            }
             if (q->fname) {
                 trace ("waveform: removed from queue. (%s)\n",q->fname);
                 free (q->fname);
@@ -93,9 +102,255 @@ queue_pop (const char *fname)
             break;
         }
     }
-    queue = next;
-    if (!queue) {
-        queue_tail = NULL;
-    }
     deadbeef->mutex_unlock (mutex);
 }
+
+typedef struct worker_job_s
+{
+    worker_func_t func;
+    worker_func_t free_func;
+    void *ctx;
+    void *owner;
+    struct worker_job_s *next;
+} worker_job_t;
+
+typedef struct
+{
+    worker_job_t *head;
+    worker_job_t *tail;
+} worker_job_list_t;
+
+static uintptr_t pool_mutex = 0;
+static uintptr_t pool_cond = 0;
+static intptr_t pool_threads[WORKER_POOL_MAX_THREADS];
+static int pool_num_threads = 0;
+static int pool_reserve_playing = 0;
+static volatile int pool_stopping = 0;
+// owner of the job each worker is running, guarded by pool_mutex
+static void *pool_running[WORKER_POOL_MAX_THREADS];
+// one fifo per priority, lower index wins
+static worker_job_list_t pool_jobs[N_WORKER_PRIORITIES];
+
+// Takes the most important pending job. Worker 0 is reserved for
+// WORKER_PRIORITY_PLAYING so the visible waveform never waits for
+// background work as long as there is more than one worker.
+static worker_job_t *
+worker_pool_take (int worker)
+{
+    const int max_priority = (worker == 0 && pool_reserve_playing) ? WORKER_PRIORITY_PLAYING : N_WORKER_PRIORITIES - 1;
+    for (int prio = 0; prio <= max_priority; prio++) {
+        worker_job_list_t *list = &pool_jobs[prio];
+        worker_job_t *job = list->head;
+        if (job) {
+            list->head = job->next;
+            if (!list->head) {
+                list->tail = NULL;
+            }
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void
+worker_pool_thread (void *ctx)
+{
+    const int worker = (int)(intptr_t)ctx;
+    deadbeef->mutex_lock (pool_mutex);
+    for (;;) {
+        worker_job_t *job = NULL;
+        while (!pool_stopping && !(job = worker_pool_take (worker))) {
+            deadbeef->cond_wait (pool_cond, pool_mutex);
+        }
+        if (pool_stopping) {
+            break;
+        }
+        pool_running[worker] = job->owner;
+        deadbeef->mutex_unlock (pool_mutex);
+        job->func (job->ctx);
+        free (job);
+        deadbeef->mutex_lock (pool_mutex);
+        pool_running[worker] = NULL;
+        // wakes up worker_pool_cancel
+        deadbeef->cond_broadcast (pool_cond);
+    }
+    deadbeef->mutex_unlock (pool_mutex);
+}
+
+void
+worker_pool_start (int num_threads)
+{
+    if (pool_num_threads > 0) {
+        return;
+    }
+    num_threads = MAX (1, MIN (num_threads, WORKER_POOL_MAX_THREADS));
+    pool_mutex = deadbeef->mutex_create ();
+    pool_cond = deadbeef->cond_create ();
+    pool_stopping = 0;
+    pool_reserve_playing = num_threads > 1;
+    memset (pool_jobs, 0, sizeof (pool_jobs));
+    memset (pool_running, 0, sizeof (pool_running));
+    for (int i = 0; i < num_threads; i++) {
+        pool_threads[i] = deadbeef->thread_start_low_priority (worker_pool_thread, (void *)(intptr_t)i);
+        if (pool_threads[i]) {
+            pool_num_threads++;
+        }
+    }
+    trace ("waveform: started %d analysis workers\n", pool_num_threads);
+}
+
+void
+worker_pool_stop (void)
+{
+    if (!pool_mutex) {
+        return;
+    }
+    deadbeef->mutex_lock (pool_mutex);
+    pool_stopping = 1;
+    deadbeef->cond_broadcast (pool_cond);
+    deadbeef->mutex_unlock (pool_mutex);
+
+    for (int i = 0; i < WORKER_POOL_MAX_THREADS; i++) {
+        if (pool_threads[i]) {
+            deadbeef->thread_join (pool_threads[i]);
+            pool_threads[i] = 0;
+        }
+    }
+    pool_num_threads = 0;
+
+    for (int prio = 0; prio < N_WORKER_PRIORITIES; prio++) {
+        worker_job_t *job = pool_jobs[prio].head;
+        while (job) {
+            worker_job_t *next = job->next;
+            if (job->free_func) {
+                job->free_func (job->ctx);
+            }
+            free (job);
+            job = next;
+        }
+        pool_jobs[prio].head = pool_jobs[prio].tail = NULL;
+    }
+
+    deadbeef->cond_free (pool_cond);
+    pool_cond = 0;
+    deadbeef->mutex_free (pool_mutex);
+    pool_mutex = 0;
+}
+
+int
+worker_pool_stopping (void)
+{
+    return pool_stopping;
+}
+
+int
+worker_pool_push (worker_func_t func, worker_func_t free_func, void *ctx, void *owner, int priority)
+{
+    if (!pool_mutex || pool_num_threads <= 0 || pool_stopping) {
+        return 0;
+    }
+    worker_job_t *job = malloc (sizeof (worker_job_t));
+    if (!job) {
+        return 0;
+    }
+    memset (job, 0, sizeof (worker_job_t));
+    job->func = func;
+    job->free_func = free_func;
+    job->ctx = ctx;
+    job->owner = owner;
+
+    priority = MAX (0, MIN (priority, N_WORKER_PRIORITIES - 1));
+    deadbeef->mutex_lock (pool_mutex);
+    if (pool_stopping) {
+        deadbeef->mutex_unlock (pool_mutex);
+        free (job);
+        return 0;
+    }
+    worker_job_list_t *list = &pool_jobs[priority];
+    if (list->tail) {
+        list->tail->next = job;
+        list->tail = job;
+    }
+    else {
+        list->head = list->tail = job;
+    }
+    deadbeef->cond_broadcast (pool_cond);
+    deadbeef->mutex_unlock (pool_mutex);
+    return 1;
+}
+
+// Call with pool_mutex held. Returns the unlinked jobs of owner as a list.
+static worker_job_t *
+worker_pool_unlink_owner (void *owner)
+{
+    worker_job_t *dropped = NULL;
+    for (int prio = 0; prio < N_WORKER_PRIORITIES; prio++) {
+        worker_job_list_t *list = &pool_jobs[prio];
+        worker_job_t *prev = NULL;
+        worker_job_t *job = list->head;
+        while (job) {
+            worker_job_t *next = job->next;
+            if (job->owner == owner) {
+                if (prev) {
+                    prev->next = next;
+                }
+                else {
+                    list->head = next;
+                }
+                if (list->tail == job) {
+                    list->tail = prev;
+                }
+                job->next = dropped;
+                dropped = job;
+            }
+            else {
+                prev = job;
+            }
+            job = next;
+        }
+    }
+    return dropped;
+}
+
+// Call with pool_mutex held.
+static int
+worker_pool_owner_running (void *owner)
+{
+    for (int i = 0; i < WORKER_POOL_MAX_THREADS; i++) {
+        if (pool_running[i] == owner) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void
+worker_pool_cancel (void *owner)
+{
+    if (!pool_mutex || !owner) {
+        return;
+    }
+    deadbeef->mutex_lock (pool_mutex);
+    for (;;) {
+        worker_job_t *dropped = worker_pool_unlink_owner (owner);
+        if (dropped) {
+            // free functions may take other locks, don't hold the pool's
+            deadbeef->mutex_unlock (pool_mutex);
+            while (dropped) {
+                worker_job_t *next = dropped->next;
+                if (dropped->free_func) {
+                    dropped->free_func (dropped->ctx);
+                }
+                free (dropped);
+                dropped = next;
+            }
+            deadbeef->mutex_lock (pool_mutex);
+            continue;
+        }
+        if (!worker_pool_owner_running (owner)) {
+            break;
+        }
+        deadbeef->cond_wait (pool_cond, pool_mutex);
+    }
+    deadbeef->mutex_unlock (pool_mutex);
+}
@@ -41,4 +41,40 @@ queue_add (const char *fname);
 void
 queue_pop (const char *fname);
 
+#define WORKER_POOL_MAX_THREADS (16)
+
+enum WORKER_PRIORITY {
+    WORKER_PRIORITY_PLAYING,
+    WORKER_PRIORITY_UPCOMING,
+    WORKER_PRIORITY_BACKGROUND,
+    N_WORKER_PRIORITIES
+};
+
+typedef void (*worker_func_t)(void *ctx);
+
+void
+worker_pool_start (int num_threads);
+
+// Joins all workers, pending jobs are dropped through their free_func.
+void
+worker_pool_stop (void);
+
+// Set as soon as worker_pool_stop has been called. Long running jobs poll it
+// so that stopping the pool never waits for a full decode.
+int
+worker_pool_stopping (void);
+
+// Queues func (ctx) to run on the analysis pool. owner identifies the object
+// the job works on for worker_pool_cancel, it may be NULL. Returns 0 if the
+// job could not be queued, in which case ownership of ctx stays with the
+// caller.
+int
+worker_pool_push (worker_func_t func, worker_func_t free_func, void *ctx, void *owner, int priority);
+
+// Drops all queued jobs of owner and waits for its running ones to return,
+// including jobs they queue in the meantime. Must not be called from a
+// worker.
+void
+worker_pool_cancel (void *owner);
+
 #endif
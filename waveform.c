@@ -32,18 +32,22 @@
 #include <assert.h>
 #include <math.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <gtk/gtk.h>
 #include <deadbeef/deadbeef.h>
 #include <deadbeef/gtkui_api.h>
 
 #include "support.h"
 #include "cache.h"
+#include "memcache.h"
 #include "config.h"
 #include "config_dialog.h"
 #include "utils.h"
 #include "waveform.h"
 #include "render.h"
 #include "ruler.h"
+#include "reduce.h"
+#include "pyramid.h"
 
 #define W_COLOR(X) (X)->r, (X)->g, (X)->b, (X)->a
 
@@ -53,6 +57,34 @@
 #define MAX_CHANNELS (6)
 #define MAX_SAMPLES (4096)
 #define DISTANCE_THRESHOLD (100)
+// parallel analysis
+#define MAX_CHUNKS (16)
+#define CHUNK_MIN_SLOTS (64)
+#define CHUNK_MIN_DURATION (120.f)
+#define CHUNK_SEEK_TOLERANCE (0.01f)
+// preview pass
+#define PREVIEW_POINTS (256)
+#define PREVIEW_WINDOW_FRAMES (4096)
+// background jobs
+#define JOB_GENERATION_NONE (-1)
+#define SCAN_BATCH_SIZE (64)
+#define SCAN_MAX_LOAD (0.5)
+#define SCAN_THROTTLE_MS (2000)
+#define EVICT_BATCH_SIZE (32)
+#define ZOOM_STEP (2.f)
+#define ZOOM_MIN_DURATION (1.f)
+// detail is fetched at this many slots per visible pixel so that the next
+// zoom step still has enough resolution
+#define DETAIL_OVERSAMPLING (2)
+// slots of the whole-track level stored for zooming, the detail buffer holds
+// this many slots of MAX_CHANNELS
+#define DETAIL_LEVEL_SAMPLES (16384)
+#define DETAIL_BUFFER_LEN (DETAIL_LEVEL_SAMPLES * VALUES_PER_SAMPLE * MAX_CHANNELS)
+// decoded bytes hashed from the middle of a track to recognize its audio
+#define FINGERPRINT_WINDOW_BYTES (16384)
+// subtracks of a CUE image analysed in one pass
+#define IMAGE_MAX_SUBTRACKS (99)
+#define IMAGE_READ_FRAMES (4096)
 
 
 /* Global variables */
@@ -65,8 +97,10 @@ static char cache_path[PATH_MAX];
 enum PLAYBACK_STATUS { STOPPED = 0, PLAYING = 1, PAUSED = 2 };
 static int playback_status = STOPPED;
 static int waveform_instancecount;
+// the widget is registered as single instance
+static struct waveform_s *waveform_instance = NULL;
 
-typedef struct
+typedef struct waveform_s
 {
     ddb_gtkui_widget_t base;
     GtkWidget *popup;
@@ -90,8 +124,41 @@ typedef struct
     intptr_t mutex;
     cairo_surface_t *surf;
     cairo_surface_t *surf_shaded;
+    // bumped whenever the playing track changes, invalidates running jobs
+    volatile int job_generation;
+    // track of the current job generation, only compared against by jobs,
+    // set under mutex
+    DB_playItem_t *job_track;
+    // visible time range while zoomed in, view_end <= 0 shows the whole track
+    float view_start;
+    float view_end;
+    // bumped whenever the visible range changes, invalidates detail jobs
+    volatile int view_generation;
+    // set by waveform_destroy, aborts every job of this widget
+    volatile int closing;
+    // decoded range [detail_start, detail_end] at higher resolution than
+    // wave, guarded by mutex
+    wavedata_t *detail;
+    float detail_start;
+    float detail_end;
+    // last track a zoom level was requested for, guarded by mutex
+    DB_playItem_t *level_track;
+    // columns of the last redraw, reused by the next one
+    waveform_data_render_t *render;
 } waveform_t;
 
+typedef struct
+{
+    waveform_t *w;
+    DB_playItem_t *it;
+    // JOB_GENERATION_NONE for jobs which outlive track changes
+    int generation;
+    // only fills the cache, never touches the widget
+    int cache_only;
+    // JOB_GENERATION_NONE for jobs which don't depend on the visible range
+    int view_generation;
+} waveform_job_t;
+
 typedef struct
 {
     double x;
@@ -111,11 +178,115 @@ static gboolean
 waveform_redraw_cb (void *user_data);
 
 static void
-waveform_draw (void *user_data, int shaded);
+waveform_draw (void *user_data);
 
 static gboolean
 waveform_set_refresh_interval (void *user_data, int interval);
 
+// Jobs of a closing widget or a stopping plugin end as soon as possible,
+// no matter if they were started as background jobs.
+static inline int
+waveform_job_abandoned (waveform_job_t *job)
+{
+    return worker_pool_stopping () || job->w->closing;
+}
+
+// A job analysing the track that has just started playing is not
+// superseded, e.g. a prefetch is the job the playing track would otherwise
+// wait for.
+static inline int
+waveform_job_superseded (waveform_job_t *job)
+{
+    return job->generation != JOB_GENERATION_NONE && job->generation != job->w->job_generation
+        && job->it != job->w->job_track;
+}
+
+static inline int
+waveform_job_cancelled (waveform_job_t *job)
+{
+    return waveform_job_abandoned (job)
+        || waveform_job_superseded (job)
+        || (job->view_generation != JOB_GENERATION_NONE && job->view_generation != job->w->view_generation);
+}
+
+// Turns a prefetch whose track started playing into the job showing it, the
+// job started for the playing track finds its key taken and gives up.
+// Returns 1 if the job shows its track.
+static int
+waveform_job_promote (waveform_job_t *job)
+{
+    if (!job->cache_only) {
+        return 1;
+    }
+    if (job->generation == JOB_GENERATION_NONE) {
+        return 0;
+    }
+    waveform_t *w = job->w;
+    deadbeef->mutex_lock (w->mutex);
+    if (job->it == w->job_track) {
+        trace ("waveform: prefetch of the playing track takes over\n");
+        job->cache_only = 0;
+    }
+    deadbeef->mutex_unlock (w->mutex);
+    return !job->cache_only;
+}
+
+static void
+waveform_scanner_start (waveform_t *w);
+
+static void
+waveform_evictor_start (void);
+
+// Call with w->mutex held after w->wave has been modified.
+static void
+waveform_wave_changed (waveform_t *w)
+{
+    waveform_pyramid_build (w->wave->pyramid, w->wave->data, w->wave->data_len, w->wave->channels);
+}
+
+static void
+waveform_view_get (waveform_t *w, float duration, float *start, float *end)
+{
+    *start = 0.f;
+    *end = duration;
+    if (w->view_end > w->view_start && w->view_end <= duration) {
+        *start = w->view_start;
+        *end = w->view_end;
+    }
+}
+
+// Maps a position on the seekbar to a time of the visible range.
+static float
+waveform_view_time (waveform_t *w, float duration, double x, double width)
+{
+    float start, end;
+    waveform_view_get (w, duration, &start, &end);
+    return start + x * (end - start) / width;
+}
+
+static double
+waveform_view_x (waveform_t *w, float duration, float time, double width)
+{
+    float start, end;
+    waveform_view_get (w, duration, &start, &end);
+    return (time - start) * width / (end - start);
+}
+
+static void
+waveform_view_reset (waveform_t *w)
+{
+    w->view_start = 0.f;
+    w->view_end = 0.f;
+    w->view_generation++;
+    deadbeef->mutex_lock (w->mutex);
+    w->detail->data_len = 0;
+    w->detail->channels = 0;
+    w->detail_start = 0.f;
+    w->detail_end = 0.f;
+    waveform_pyramid_build (w->detail->pyramid, NULL, 0, 0);
+    deadbeef->mutex_unlock (w->mutex);
+}
+
 static color_t
 waveform_color_contrast (color_t *color)
 {
@@ -184,7 +355,13 @@ static int
 on_config_changed (void *widget)
 {
     waveform_t *w = (waveform_t *) widget;
+    const int num_samples = CONFIG_NUM_SAMPLES;
     load_config ();
+    if (num_samples != CONFIG_NUM_SAMPLES) {
+        // everything in memory was analysed at the old resolution
+        waveform_memcache_clear ();
+    }
+    waveform_memcache_set_budget ((size_t)MAX (CONFIG_MEMORY_CACHE_SIZE, 0) * 1024 * 1024);
     waveform_colors_update (w);
     // enable/disable border
     switch (CONFIG_BORDER_WIDTH) {
@@ -205,6 +382,10 @@ on_config_changed (void *widget)
     }
 
     waveform_set_refresh_interval (w, CONFIG_REFRESH_INTERVAL);
+    if (CONFIG_IDLE_SCAN) {
+        waveform_scanner_start (w);
+    }
+    waveform_evictor_start ();
     g_idle_add (waveform_redraw_cb, w);
     return 0;
 }
@@ -321,10 +502,12 @@ waveform_draw_cb (void *user_data)
     const float dur = deadbeef->pl_get_item_duration (trk);
     deadbeef->pl_item_unref (trk);
 
-    const float pos = (deadbeef->streamer_get_playpos () * width)/ dur;
+    const float pos = waveform_view_x (w, dur, deadbeef->streamer_get_playpos (), width);
     // use 8 times (*8/1000 => /125 ) the amount of pixels per refresh to 
     // prevent skipped areas
-    float size = width/dur * CONFIG_REFRESH_INTERVAL/125;
+    float view_start, view_end;
+    waveform_view_get (w, dur, &view_start, &view_end);
+    float size = width/(view_end - view_start) * CONFIG_REFRESH_INTERVAL/125;
 
     const double doubleCursorWidth = CONFIG_CURSOR_WIDTH * 2;
     size = (size < doubleCursorWidth ? doubleCursorWidth : size);
@@ -343,8 +526,7 @@ waveform_redraw_cb (void *user_data)
         g_source_remove (w->resizetimer);
         w->resizetimer = 0;
     }
-    waveform_draw (w, 0);
-    waveform_draw (w, 1);
+    waveform_draw (w);
     gtk_widget_queue_draw (w->drawarea);
     return FALSE;
 }
@@ -379,7 +561,7 @@ waveform_draw_seeking_cursor (waveform_t *w, cairo_t *cr, float duration, wavefo
     if (w->seekbar_move_x != w->seekbar_move_x_clicked || w->seekbar_move_x_clicked == -1) {
         w->seekbar_move_x_clicked = -1;
 
-        const float cur_time = CLAMP (w->seekbar_move_x * duration / rect->width, 0, duration);
+        const float cur_time = CLAMP (waveform_view_time (w, duration, w->seekbar_move_x, rect->width), 0, duration);
         const int hr = cur_time / 3600;
         const int mn = (cur_time - hr * 3600)/60;
         const int sc = cur_time - hr * 3600 - mn * 60;
@@ -440,7 +622,7 @@ waveform_seekbar_draw (gpointer user_data, cairo_t *cr, waveform_rect_t *rect)
     const double height = rect->height;
 
     const float dur = deadbeef->pl_get_item_duration (trk);
-    const float pos = (deadbeef->streamer_get_playpos () * width)/ dur + left;
+    const float pos = waveform_view_x (w, dur, deadbeef->streamer_get_playpos (), width) + left;
     int cursor_width = CONFIG_CURSOR_WIDTH;
 
     if (!deadbeef->is_local_file (deadbeef->pl_find_meta_raw (trk, ":URI"))) {
@@ -496,8 +678,42 @@ waveform_draw_surface_update (cairo_surface_t *surface, double width, double hei
     return surface;
 }
 
+// Strokes every channel of the render data in colors over a background
+// which has already been drawn.
+static void
+waveform_draw_channels (waveform_data_render_t *w_render_ctx, waveform_colors_t *colors, cairo_t *cr, int width, int height)
+{
+    const int channels = w_render_ctx->num_channels;
+    const double channel_height = height/channels;
+    const double waveform_height = 0.9 * channel_height;
+    const double x = 0.0;
+    double y = (channel_height - waveform_height)/2;
+
+    for (int ch = 0; ch < channels; ch++, y += channel_height) {
+        const waveform_columns_t *columns = &w_render_ctx->columns[ch];
+        waveform_rect_t rect = {
+            .x = x,
+            .y = y,
+            .width = width,
+            .height = waveform_height,
+        };
+        switch (CONFIG_RENDER_METHOD) {
+            case SPIKES:
+                waveform_draw_wave_default (columns, colors, cr, &rect);
+                break;
+            case BARS:
+                waveform_draw_wave_bars (columns, colors, cr, &rect);
+                break;
+            default:
+                waveform_draw_wave_default (columns, colors, cr, &rect);
+                break;
+        }
+    }
+}
+
+// Redraws surf and surf_shaded from a single build of the render data.
 static void
-waveform_draw (void *user_data, int shaded)
+waveform_draw (void *user_data)
 {
     waveform_t *w = user_data;
     GtkAllocation a;
@@ -509,71 +725,76 @@ waveform_draw (void *user_data, int shaded)
     w->width = width;
     w->height = height;
 
-    cairo_surface_t *surface;
-    if (!shaded) {
-        w->surf = waveform_draw_surface_update (w->surf, width, height);
-        surface = w->surf;
+    w->surf = waveform_draw_surface_update (w->surf, width, height);
+    w->surf_shaded = waveform_draw_surface_update (w->surf_shaded, width, height);
+
+    float duration = 0.f;
+    DB_playItem_t *trk = deadbeef->streamer_get_playing_track ();
+    if (trk) {
+        duration = deadbeef->pl_get_item_duration (trk);
+        deadbeef->pl_item_unref (trk);
+    }
+    float view_start, view_end;
+    waveform_view_get (w, duration, &view_start, &view_end);
+
+    // prefer decoded detail of the visible range over the stored waveform
+    waveform_data_render_t *w_render_ctx = w->render;
+    int have_data = 0;
+    deadbeef->mutex_lock (w->mutex);
+    if (duration > 0 && w->detail->data_len > 0 && w->detail_start <= view_start && w->detail_end >= view_end) {
+        const float detail_len = w->detail_end - w->detail_start;
+        have_data = waveform_render_data_build (w_render_ctx,
+                                                w->detail,
+                                                width,
+                                                CONFIG_MIX_TO_MONO,
+                                                (view_start - w->detail_start) / detail_len,
+                                                (view_end - w->detail_start) / detail_len);
     }
     else {
-        w->surf_shaded = waveform_draw_surface_update (w->surf_shaded, width, height);
-        surface = w->surf_shaded;
+        have_data = waveform_render_data_build (w_render_ctx,
+                                                w->wave,
+                                                width,
+                                                CONFIG_MIX_TO_MONO,
+                                                duration > 0 ? view_start / duration : 0.f,
+                                                duration > 0 ? view_end / duration : 1.f);
     }
+    deadbeef->mutex_unlock (w->mutex);
 
-    cairo_surface_flush (surface);
-    cairo_t *cr = cairo_create (surface);
-    assert (cr != NULL);
-
-    waveform_data_render_t *w_render_ctx = waveform_render_data_build (w->wave, width, CONFIG_MIX_TO_MONO);
-
-    // Draw background
     waveform_rect_t bg_rect = {
         .x = 0,
         .y = 0,
         .width = width,
         .height = height,
     };
+
+    cairo_surface_flush (w->surf);
+    cairo_t *cr = cairo_create (w->surf);
+    assert (cr != NULL);
     waveform_draw_cairo_rectangle (cr, &w->colors.bg, &bg_rect);
+    if (have_data) {
+        waveform_draw_channels (w_render_ctx, &w->colors, cr, width, height);
+    }
+    cairo_destroy (cr);
 
-    if (w_render_ctx) {
-
-        const int channels = w_render_ctx->num_channels;
-        const double channel_height = height/channels;
-        const double waveform_height = 0.9 * channel_height;
-        const double x = 0.0;
-        double y = (channel_height - waveform_height)/2;
-
-        waveform_colors_t *colors = &w->colors;
-        if (CONFIG_SHADE_WAVEFORM && shaded) {
-            colors = &w->colors_shaded;
-        }
-
-        for (int ch = 0; ch < channels; ch++, y += channel_height) {
-            waveform_sample_t *samples = w_render_ctx->samples[ch];
-            waveform_rect_t rect = {
-                .x = x,
-                .y = y,
-                .width = width,
-                .height = waveform_height,
-            };
-            switch (CONFIG_RENDER_METHOD) {
-                case SPIKES:
-                    waveform_draw_wave_default (samples, colors, cr, &rect);
-                    break;
-                case BARS:
-                    waveform_draw_wave_bars (samples, colors, cr, &rect);
-                    break;
-                default:
-                    waveform_draw_wave_default (samples, colors, cr, &rect);
-                    break;
-            }
-        }
-        if (!CONFIG_SHADE_WAVEFORM && shaded == 1) {
+    cairo_surface_flush (w->surf_shaded);
+    cr = cairo_create (w->surf_shaded);
+    assert (cr != NULL);
+    if (have_data && CONFIG_SHADE_WAVEFORM) {
+        // the played part has colors of its own, only the geometry is shared
+        waveform_draw_cairo_rectangle (cr, &w->colors.bg, &bg_rect);
+        waveform_draw_channels (w_render_ctx, &w->colors_shaded, cr, width, height);
+    }
+    else {
+        // otherwise it is the normal surface under a tint
+        cairo_surface_flush (w->surf);
+        cairo_set_source_surface (cr, w->surf, 0, 0);
+        cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint (cr);
+        cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+        if (have_data) {
             waveform_draw_cairo_rectangle (cr, &w->colors_shaded.pb, &bg_rect);
         }
-
-        waveform_data_render_free (w_render_ctx);
     }
-
     cairo_destroy (cr);
     return;
 }
@@ -597,19 +818,324 @@ waveform_scale (void *user_data, cairo_t *cr, waveform_rect_t *rect)
     }
 }
 
-static gboolean
-waveform_generate_wavedata (gpointer user_data, DB_playItem_t *it, const char *uri, wavedata_t *wavedata)
+// Decoder output on its way to the reduction. Formats the reduce kernels read
+// directly skip the float conversion, data is only allocated for the rest.
+typedef struct
 {
-    waveform_t *w = user_data;
-    const double width = CONFIG_NUM_SAMPLES;
+    ddb_waveformat_t fmt;
+    waveform_pcm_t pcm;
+    int samplesize;
+    float *data;
+} waveform_ingest_t;
 
-    DB_fileinfo_t *fileinfo = NULL;
+static int
+waveform_ingest_init (waveform_ingest_t *ingest, const ddb_waveformat_t *fmt, int max_frames)
+{
+    ingest->fmt = *fmt;
+    ingest->pcm = waveform_pcm_format (fmt->bps, fmt->is_float, fmt->is_bigendian);
+    ingest->samplesize = fmt->channels * (fmt->bps / 8);
+    ingest->data = NULL;
+    if (ingest->pcm == WAVEFORM_PCM_NONE) {
+        ingest->data = malloc (sizeof (float) * max_frames * fmt->channels);
+        if (!ingest->data) {
+            trace ("waveform: out of memory.\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void
+waveform_ingest_free (waveform_ingest_t *ingest)
+{
+    if (ingest->data) {
+        free (ingest->data);
+        ingest->data = NULL;
+    }
+}
+
+static void
+waveform_ingest_reduce (waveform_ingest_t *ingest, const char *buffer, int frames, float *min, float *max, float *sum_sq)
+{
+    const int channels = ingest->fmt.channels;
+    if (ingest->pcm != WAVEFORM_PCM_NONE) {
+        waveform_reduce_pcm (buffer, frames, channels, ingest->pcm, min, max, sum_sq);
+        return;
+    }
+    ddb_waveformat_t out_fmt = {
+        .bps = 32,
+        .channels = channels,
+        .samplerate = ingest->fmt.samplerate,
+        .channelmask = ingest->fmt.channelmask,
+        .is_float = 1,
+        .is_bigendian = 0
+    };
+    deadbeef->pcm_convert (&ingest->fmt, buffer, &out_fmt, (char *)ingest->data, frames * ingest->samplesize);
+    waveform_reduce (ingest->data, frames, channels, min, max, sum_sq);
+}
+
+static void
+waveform_reduce_buffer (waveform_ingest_t *ingest, const char *buffer, int frames, short *out)
+{
+    const int channels = ingest->fmt.channels;
+    float min[MAX_CHANNELS];
+    float max[MAX_CHANNELS];
+    float sum_sq[MAX_CHANNELS];
+
+    waveform_ingest_reduce (ingest, buffer, frames, min, max, sum_sq);
+    for (int ch = 0; ch < channels; ch++) {
+        const float rms = frames > 0 ? sqrt (sum_sq[ch] / frames) : 0.0;
+        out[0] = (short)(max[ch]*1000);
+        out[1] = (short)(min[ch]*1000);
+        out[2] = (short)(rms*1000);
+        out += VALUES_PER_SAMPLE;
+    }
+}
+
+typedef struct
+{
+    waveform_job_t *job;
+    DB_decoder_t *dec;
+    wavedata_t *wavedata;
+    ddb_waveformat_t fmt;
+    int samples_per_buf;
+    // frame at which slot 0 starts
+    int frame_offset;
+    int slot_start;
+    int slot_end;
+    // one past the last slot written, short of slot_end if the track ended
+    // early
+    int slot_done;
+    int failed;
+} waveform_chunk_t;
+
+static void
+waveform_chunk_decode (void *ctx)
+{
+    waveform_chunk_t *chunk = ctx;
+    DB_decoder_t *dec = chunk->dec;
+    float *buffer = NULL;
+    waveform_ingest_t ingest = { .data = NULL };
+    chunk->slot_done = chunk->slot_start;
+
+    DB_fileinfo_t *fileinfo = dec->open (0);
+    if (!fileinfo || dec->init (fileinfo, DB_PLAYITEM (chunk->job->it)) != 0) {
+        chunk->failed = 1;
+        goto out;
+    }
+    if (fileinfo->fmt.channels != chunk->fmt.channels || fileinfo->fmt.samplerate != chunk->fmt.samplerate) {
+        chunk->failed = 1;
+        goto out;
+    }
+
+    const int start_sample = chunk->frame_offset + chunk->slot_start * chunk->samples_per_buf;
+    if (start_sample > 0) {
+        if (dec->seek_sample (fileinfo, start_sample) != 0) {
+            chunk->failed = 1;
+            goto out;
+        }
+        // decoders which only seek to the nearest frame/page would smear
+        // chunk boundaries, those are analysed serially instead
+        const float expected_pos = start_sample / (float)fileinfo->fmt.samplerate;
+        if (fabsf (fileinfo->readpos - expected_pos) > CHUNK_SEEK_TOLERANCE) {
+            trace ("waveform: inaccurate seek (%f != %f)\n", fileinfo->readpos, expected_pos);
+            chunk->failed = 1;
+            goto out;
+        }
+    }
+
+    const int channels = fileinfo->fmt.channels;
+    const int samplesize = channels * (fileinfo->fmt.bps / 8);
+    const int buffer_len = chunk->samples_per_buf * samplesize;
+    buffer = malloc (sizeof (float) * chunk->samples_per_buf * samplesize);
+    if (!buffer || !waveform_ingest_init (&ingest, &fileinfo->fmt, chunk->samples_per_buf)) {
+        trace ("waveform: out of memory.\n");
+        chunk->failed = 1;
+        goto out;
+    }
+
+    for (int slot = chunk->slot_start; slot < chunk->slot_end; slot++) {
+        if (waveform_job_cancelled (chunk->job)) {
+            chunk->failed = 1;
+            break;
+        }
+        const int sz = dec->read (fileinfo, (char *)buffer, buffer_len);
+        if (sz <= 0) {
+            break;
+        }
+        waveform_reduce_buffer (&ingest, (char *)buffer, sz/samplesize, chunk->wavedata->data + slot * channels * VALUES_PER_SAMPLE);
+        chunk->slot_done = slot + 1;
+        if (sz != buffer_len) {
+            break;
+        }
+    }
+
+out:
+    waveform_ingest_free (&ingest);
+    if (buffer) {
+        free (buffer);
+        buffer = NULL;
+    }
+    if (fileinfo) {
+        dec->free (fileinfo);
+        fileinfo = NULL;
+    }
+}
+
+// Builds a coarse full-width waveform by seeking to evenly spaced points of
+// the track and decoding a short window at each one. Every window fills all
+// slots up to the next point, the exact scan overwrites them afterwards.
+// On failure the slots are cleared again.
+static int
+waveform_generate_preview (waveform_job_t *job,
+                           DB_decoder_t *dec,
+                           ddb_waveformat_t *fmt,
+                           wavedata_t *wavedata,
+                           int samples_per_buf,
+                           int num_slots)
+{
+    if (!dec->seek_sample || num_slots <= 0) {
+        return 0;
+    }
+
+    int result = 0;
+    float *buffer = NULL;
+    waveform_ingest_t ingest = { .data = NULL };
+
+    DB_fileinfo_t *fileinfo = dec->open (0);
+    if (!fileinfo || dec->init (fileinfo, DB_PLAYITEM (job->it)) != 0) {
+        goto out;
+    }
+    if (fileinfo->fmt.channels != fmt->channels || fileinfo->fmt.samplerate != fmt->samplerate) {
+        goto out;
+    }
+
+    const int channels = fileinfo->fmt.channels;
+    const int samplesize = channels * (fileinfo->fmt.bps / 8);
+    const int window = MIN (samples_per_buf, PREVIEW_WINDOW_FRAMES);
+    const int buffer_len = window * samplesize;
+    buffer = malloc (sizeof (float) * window * samplesize);
+    if (!buffer || !waveform_ingest_init (&ingest, &fileinfo->fmt, window)) {
+        trace ("waveform: out of memory.\n");
+        goto out;
+    }
+
+    const int sample_size = channels * VALUES_PER_SAMPLE;
+    const int num_points = MIN (num_slots, PREVIEW_POINTS);
+    for (int p = 0; p < num_points; p++) {
+        if (waveform_job_cancelled (job)) {
+            goto out;
+        }
+        const int slot_start = (int)((int64_t)num_slots * p / num_points);
+        const int slot_end = (int)((int64_t)num_slots * (p + 1) / num_points);
+        if (dec->seek_sample (fileinfo, slot_start * samples_per_buf) != 0) {
+            goto out;
+        }
+        const int sz = dec->read (fileinfo, (char *)buffer, buffer_len);
+        if (sz <= 0) {
+            break;
+        }
+        short *first = wavedata->data + slot_start * sample_size;
+        waveform_reduce_buffer (&ingest, (char *)buffer, sz/samplesize, first);
+        for (int slot = slot_start + 1; slot < slot_end; slot++) {
+            memcpy (wavedata->data + slot * sample_size, first, sample_size * sizeof (short));
+        }
+    }
+    result = 1;
+
+out:
+    if (!result) {
+        memset (wavedata->data, 0, (size_t)num_slots * fmt->channels * VALUES_PER_SAMPLE * sizeof (short));
+    }
+    waveform_ingest_free (&ingest);
+    if (buffer) {
+        free (buffer);
+        buffer = NULL;
+    }
+    if (fileinfo) {
+        dec->free (fileinfo);
+        fileinfo = NULL;
+    }
+    return result;
+}
+
+static int
+waveform_num_chunks (DB_decoder_t *dec, float duration, int num_slots)
+{
+    if (!CONFIG_PARALLEL_ANALYSIS || !dec->seek_sample || duration < CHUNK_MIN_DURATION) {
+        return 1;
+    }
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+    int chunks = MIN (cpus, MAX_CHUNKS);
+    // don't split into chunks smaller than a handful of slots
+    chunks = MIN (chunks, num_slots / CHUNK_MIN_SLOTS);
+    return MAX (1, chunks);
+}
+
+// Splits the track into time ranges which are decoded by independent
+// decoder instances in parallel. Returns the number of slots written or 0 if
+// any chunk failed or the job got cancelled. The track may end before the
+// duration it was split by, but only in the last chunk, a gap anywhere else
+// counts as a failure.
+static int
+waveform_generate_wavedata_chunked (waveform_job_t *job,
+                                    DB_decoder_t *dec,
+                                    ddb_waveformat_t *fmt,
+                                    wavedata_t *wavedata,
+                                    int samples_per_buf,
+                                    int num_slots,
+                                    int num_chunks)
+{
+    waveform_chunk_t chunks[MAX_CHUNKS];
+    intptr_t tids[MAX_CHUNKS];
+    memset (chunks, 0, sizeof (chunks));
+    memset (tids, 0, sizeof (tids));
+
+    for (int i = 0; i < num_chunks; i++) {
+        chunks[i].job = job;
+        chunks[i].dec = dec;
+        chunks[i].wavedata = wavedata;
+        chunks[i].fmt = *fmt;
+        chunks[i].samples_per_buf = samples_per_buf;
+        chunks[i].slot_start = (int)((int64_t)num_slots * i / num_chunks);
+        chunks[i].slot_end = (int)((int64_t)num_slots * (i + 1) / num_chunks);
+    }
+    // the calling thread takes care of the first chunk itself
+    for (int i = 1; i < num_chunks; i++) {
+        tids[i] = deadbeef->thread_start_low_priority (waveform_chunk_decode, &chunks[i]);
+        if (!tids[i]) {
+            chunks[i].failed = 1;
+        }
+    }
+    waveform_chunk_decode (&chunks[0]);
+
+    int failed = chunks[0].failed;
+    for (int i = 1; i < num_chunks; i++) {
+        if (tids[i]) {
+            deadbeef->thread_join (tids[i]);
+        }
+        failed |= chunks[i].failed;
+    }
+    for (int i = 0; i < num_chunks - 1; i++) {
+        if (chunks[i].slot_done < chunks[i].slot_end) {
+            trace ("waveform: chunk %d ended early at slot %d of %d\n", i, chunks[i].slot_done, chunks[i].slot_end);
+            failed = 1;
+        }
+    }
+    return failed ? 0 : chunks[num_chunks - 1].slot_done;
+}
 
+static DB_decoder_t *
+waveform_decoder_find (DB_playItem_t *it)
+{
     deadbeef->pl_lock ();
     const char *dec_meta = deadbeef->pl_find_meta_raw (it, ":DECODER");
-    char decoder_id[100];
+    char decoder_id[100] = "";
     if (dec_meta) {
-        strncpy (decoder_id, dec_meta, sizeof (decoder_id));
+        strncpy (decoder_id, dec_meta, sizeof (decoder_id) - 1);
     }
     DB_decoder_t *dec = NULL;
     DB_decoder_t **decoders = deadbeef->plug_get_decoder_list ();
@@ -620,6 +1146,20 @@ waveform_generate_wavedata (gpointer user_data, DB_playItem_t *it, const char *u
         }
     }
     deadbeef->pl_unlock ();
+    return dec;
+}
+
+static gboolean
+waveform_generate_wavedata (waveform_job_t *job, const char *uri, wavedata_t *wavedata)
+{
+    waveform_t *w = job->w;
+    DB_playItem_t *it = job->it;
+    const double width = CONFIG_NUM_SAMPLES;
+    int aborted = 0;
+
+    DB_fileinfo_t *fileinfo = NULL;
+
+    DB_decoder_t *dec = waveform_decoder_find (it);
 
     wavedata->data_len = 0;
     wavedata->channels = 0;
@@ -632,7 +1172,7 @@ waveform_generate_wavedata (gpointer user_data, DB_playItem_t *it, const char *u
             deadbeef->pl_unlock ();
             goto out;
         }
-        float *data;
+        waveform_ingest_t ingest;
         float *buffer;
 
         if (fileinfo) {
@@ -642,47 +1182,103 @@ waveform_generate_wavedata (gpointer user_data, DB_playItem_t *it, const char *u
             if (duration <= 0) {
                 goto out;
             }
+            if (fileinfo->fmt.channels > MAX_CHANNELS) {
+                fprintf (stderr, "waveform: too many channels (%d)\n", fileinfo->fmt.channels);
+                goto out;
+            }
             const int bytes_per_sample = fileinfo->fmt.bps / 8;
             const int samplesize = fileinfo->fmt.channels * bytes_per_sample;
             const int nsamples_per_channel = floorf (duration * (float)fileinfo->fmt.samplerate);
             const int samples_per_buf = ceilf ((float) nsamples_per_channel / (float) width);
             const int max_samples_per_buf = 1 + samples_per_buf;
+            const int num_slots = (nsamples_per_channel + samples_per_buf - 1) / samples_per_buf;
+            const int sample_size = fileinfo->fmt.channels * VALUES_PER_SAMPLE;
 
-            w->wave->channels = fileinfo->fmt.channels;
-            w->wave->data_len = w->wave->channels * 3 * CONFIG_NUM_SAMPLES;
-            deadbeef->mutex_lock (w->mutex);
-            memset (w->wave->data, 0, sizeof (short) * w->max_buffer_len);
-            deadbeef->mutex_unlock (w->mutex);
+            if (waveform_job_cancelled (job)) {
+                aborted = 1;
+                goto out;
+            }
 
-            data = malloc (sizeof (float) * max_samples_per_buf * samplesize);
-            if (!data) {
-                trace ("waveform: out of memory.\n");
+            if (waveform_job_promote (job)) {
+                deadbeef->mutex_lock (w->mutex);
+                w->wave->channels = fileinfo->fmt.channels;
+                w->wave->data_len = w->wave->channels * 3 * CONFIG_NUM_SAMPLES;
+                memset (w->wave->data, 0, sizeof (short) * w->max_buffer_len);
+                waveform_wave_changed (w);
+                deadbeef->mutex_unlock (w->mutex);
+            }
+
+            // cache fills neither show nor need a preview
+            DB_playItem_t *playing = job->cache_only ? NULL : deadbeef->streamer_get_playing_track ();
+            if (playing) {
+                if (playing == it && waveform_generate_preview (job, dec, &fileinfo->fmt, wavedata, samples_per_buf, num_slots)) {
+                    deadbeef->mutex_lock (w->mutex);
+                    w->wave->channels = fileinfo->fmt.channels;
+                    w->wave->data_len = w->wave->channels * VALUES_PER_SAMPLE * CONFIG_NUM_SAMPLES;
+                    memcpy (w->wave->data, wavedata->data, w->wave->data_len * sizeof (short));
+                    waveform_wave_changed (w);
+                    deadbeef->mutex_unlock (w->mutex);
+                    g_idle_add (waveform_redraw_cb, w);
+                }
+                deadbeef->pl_item_unref (playing);
+            }
+
+            // cache fills stay on their pool worker
+            const int num_chunks = job->cache_only ? 1 : waveform_num_chunks (dec, duration, num_slots);
+            if (num_chunks > 1) {
+                const int slots = waveform_generate_wavedata_chunked (job, dec, &fileinfo->fmt, wavedata, samples_per_buf, num_slots, num_chunks);
+                if (slots > 0) {
+                    deadbeef->pl_lock ();
+                    wavedata->fname = strdup (deadbeef->pl_find_meta_raw (it, ":URI"));
+                    deadbeef->pl_unlock ();
+                    wavedata->data_len = slots * fileinfo->fmt.channels * VALUES_PER_SAMPLE;
+                    wavedata->channels = fileinfo->fmt.channels;
+                    goto out;
+                }
+                if (waveform_job_cancelled (job)) {
+                    aborted = 1;
+                    goto out;
+                }
+                trace ("waveform: chunked analysis failed, falling back to serial scan\n");
+            }
+
+            if (!waveform_ingest_init (&ingest, &fileinfo->fmt, max_samples_per_buf)) {
                 goto out;
             }
-            memset (data, 0, sizeof (float) * max_samples_per_buf * samplesize);
 
             buffer = malloc (sizeof (float) * max_samples_per_buf * samplesize);
             if (!buffer) {
                 trace ("waveform: out of memory.\n");
+                waveform_ingest_free (&ingest);
                 goto out;
             }
             memset (buffer, 0, sizeof (float) * max_samples_per_buf * samplesize);
 
-
-            ddb_waveformat_t out_fmt = {
-                .bps = 32,
-                .channels = fileinfo->fmt.channels,
-                .samplerate = fileinfo->fmt.samplerate,
-                .channelmask = fileinfo->fmt.channelmask,
-                .is_float = 1,
-                .is_bigendian = 0
-            };
-
             int update_counter = 0;
             int eof = 0;
             int counter = 0;
+            int cache_fill = 0;
             const long buffer_len = samples_per_buf * samplesize;
             while (!eof) {
+                if (waveform_job_abandoned (job)) {
+                    trace ("waveform: job abandoned, aborting\n");
+                    aborted = 1;
+                    break;
+                }
+                if (!cache_fill && waveform_job_cancelled (job)) {
+                    // a superseded job only keeps going as a cache fill if
+                    // most of the track has been analysed already
+                    if (CONFIG_CACHE_ENABLED && counter >= num_slots * sample_size / 2) {
+                        trace ("waveform: job superseded, finishing as cache fill\n");
+                        cache_fill = 1;
+                    }
+                    else {
+                        trace ("waveform: job superseded, aborting\n");
+                        aborted = 1;
+                        break;
+                    }
+                }
+
                 int sz = dec->read (fileinfo, (char *)buffer, buffer_len);
                 if (sz != buffer_len) {
                     eof = 1;
@@ -691,39 +1287,19 @@ waveform_generate_wavedata (gpointer user_data, DB_playItem_t *it, const char *u
                     break;
                 }
 
-                deadbeef->pcm_convert (&fileinfo->fmt, (char *)buffer, &out_fmt, (char *)data, sz);
-
-                int sample;
-                float min, max, rms;
+                waveform_reduce_buffer (&ingest, (char *)buffer, sz/samplesize, wavedata->data + counter);
+                counter += sample_size;
 
-                for (int ch = 0; ch < fileinfo->fmt.channels; ch++) {
-                    min = 1.0; max = -1.0; rms = 0.0;
-                    for (sample = 0; sample < sz/samplesize; sample++) {
-                        if (sample * fileinfo->fmt.channels > buffer_len) {
-                            fprintf (stderr, "index error!\n");
-                            break;
-                        }
-                        const float sample_val = data [sample * fileinfo->fmt.channels + ch];
-                        max = MAX (max, sample_val);
-                        min = MIN (min, sample_val);
-                        rms += (sample_val * sample_val);
-                    }
-                    rms /= sample;
-                    rms = sqrt (rms);
-                    wavedata->data[counter] = (short)(max*1000);
-                    wavedata->data[counter+1] = (short)(min*1000);
-                    wavedata->data[counter+2] = (short)(rms*1000);
-                    counter += 3;
-                }
-                if (update_counter == update_after_nsamples) {
+                if (update_counter == update_after_nsamples && !cache_fill && waveform_job_promote (job)) {
                     DB_playItem_t *playing = deadbeef->streamer_get_playing_track ();
                     if (playing) {
                         if (playing == it) {
                             deadbeef->mutex_lock (w->mutex);
                             w->wave->channels = fileinfo->fmt.channels;
                             w->wave->data_len = w->wave->channels * VALUES_PER_SAMPLE * CONFIG_NUM_SAMPLES;
-                            memset (w->wave->data, 0, sizeof (short) * w->max_buffer_len);
-                            memcpy (w->wave->data, wavedata->data, counter * sizeof (short));
+                            // slots past counter still hold the preview
+                            memcpy (w->wave->data, wavedata->data, w->wave->data_len * sizeof (short));
+                            waveform_wave_changed (w);
                             deadbeef->mutex_unlock (w->mutex);
                             g_idle_add (waveform_redraw_cb, w);
                         }
@@ -733,15 +1309,14 @@ waveform_generate_wavedata (gpointer user_data, DB_playItem_t *it, const char *u
                 }
                 update_counter++;
             }
-            wavedata->fname = strdup (deadbeef->pl_find_meta_raw (it, ":URI"));
-            wavedata->data_len = counter;
-            wavedata->channels = fileinfo->fmt.channels;
+            if (!aborted) {
+                wavedata->fname = strdup (deadbeef->pl_find_meta_raw (it, ":URI"));
+                wavedata->data_len = counter;
+                wavedata->channels = fileinfo->fmt.channels;
+            }
 
 
-            if (data) {
-                free (data);
-                data = NULL;
-            }
+            waveform_ingest_free (&ingest);
             if (buffer) {
                 free (buffer);
                 buffer = NULL;
@@ -754,23 +1329,129 @@ out:
         fileinfo = NULL;
     }
 
-    return TRUE;
+    return !aborted;
+}
+
+// Hashes a short window of decoded audio from the middle of the track. Tag
+// edits leave it unchanged while re-encodes don't. Returns 0 on failure.
+static uint64_t
+waveform_fingerprint_content (DB_playItem_t *it)
+{
+    DB_decoder_t *dec = waveform_decoder_find (it);
+    if (!dec || !dec->open || !dec->seek_sample) {
+        return 0;
+    }
+    DB_fileinfo_t *fileinfo = dec->open (0);
+    if (!fileinfo) {
+        return 0;
+    }
+    uint64_t hash = 0;
+    char *buffer = NULL;
+    if (dec->init (fileinfo, DB_PLAYITEM (it)) != 0) {
+        goto out;
+    }
+    const float duration = deadbeef->pl_get_item_duration (it);
+    if (duration > 0 && dec->seek_sample (fileinfo, duration * fileinfo->fmt.samplerate / 2) != 0) {
+        goto out;
+    }
+    buffer = malloc (FINGERPRINT_WINDOW_BYTES);
+    if (!buffer) {
+        goto out;
+    }
+    const int sz = dec->read (fileinfo, buffer, FINGERPRINT_WINDOW_BYTES);
+    if (sz <= 0) {
+        goto out;
+    }
+    // FNV-1a, 0 is reserved for unknown
+    hash = 14695981039346656037ULL;
+    for (int i = 0; i < sz; i++) {
+        hash ^= (unsigned char)buffer[i];
+        hash *= 1099511628211ULL;
+    }
+    hash |= 1;
+
+out:
+    if (buffer) {
+        free (buffer);
+        buffer = NULL;
+    }
+    dec->free (fileinfo);
+    return hash;
 }
 
 static void
-waveform_db_cache (gpointer user_data, DB_playItem_t *it, wavedata_t *wavedata)
+waveform_fingerprint_get (DB_playItem_t *it, const char *uri, int with_content, waveform_fingerprint_t *fingerprint)
 {
-    waveform_t *w = user_data;
-    char *key = waveform_format_uri (it, wavedata->fname);
-    if (!key) {
-        return;
+    memset (fingerprint, 0, sizeof (waveform_fingerprint_t));
+    struct stat st;
+    if (stat (uri, &st) == 0) {
+        fingerprint->size = st.st_size;
+        fingerprint->mtime = st.st_mtime;
     }
-    deadbeef->mutex_lock (w->mutex);
-    waveform_db_write (key, wavedata->data, wavedata->data_len * sizeof (short), wavedata->channels, 0);
-    deadbeef->mutex_unlock (w->mutex);
-    if (key) {
-        free (key);
-        key = NULL;
+    if (with_content && CONFIG_CACHE_CONTENT_HASH) {
+        fingerprint->content_hash = waveform_fingerprint_content (it);
+    }
+}
+
+// Checks the stored fingerprint of key against the file. Stale entries are
+// removed, entries whose audio survived a tag edit get the new fingerprint.
+static int
+waveform_fingerprint_validate (DB_playItem_t *it, const char *uri, const char *key, const waveform_fingerprint_t *stored)
+{
+    waveform_fingerprint_t current;
+    waveform_fingerprint_get (it, uri, 0, &current);
+    if (current.size == 0 && current.mtime == 0) {
+        // can't tell, let the decoder find out
+        return 1;
+    }
+    if (stored->size == current.size && stored->mtime == current.mtime) {
+        return 1;
+    }
+    if (stored->size == 0 && stored->mtime == 0) {
+        // cached before fingerprints existed, adopt the file as it is now
+        waveform_fingerprint_get (it, uri, 1, &current);
+        waveform_db_fingerprint_update (key, &current);
+        waveform_memcache_fingerprint_update (key, &current);
+        return 1;
+    }
+    if (CONFIG_CACHE_CONTENT_HASH && stored->content_hash) {
+        current.content_hash = waveform_fingerprint_content (it);
+        if (current.content_hash == stored->content_hash) {
+            waveform_db_fingerprint_update (key, &current);
+            waveform_memcache_fingerprint_update (key, &current);
+            return 1;
+        }
+    }
+    trace ("waveform: cached waveform of %s is stale\n", uri);
+    waveform_memcache_remove (key);
+    waveform_db_delete (key);
+    return 0;
+}
+
+// Stores freshly analysed data, in memory as well if it is going to be shown.
+static void
+waveform_db_cache (gpointer user_data, DB_playItem_t *it, wavedata_t *wavedata, int remember)
+{
+    char *key = waveform_format_uri (it, wavedata->fname);
+    if (!key) {
+        return;
+    }
+    waveform_fingerprint_t fingerprint;
+    waveform_fingerprint_get (it, wavedata->fname, 1, &fingerprint);
+    const waveform_db_info_t info = {
+        .samples = CONFIG_NUM_SAMPLES,
+        .samplerate = deadbeef->pl_find_meta_int (it, ":SAMPLERATE", 0),
+        .duration = deadbeef->pl_get_item_duration (it),
+    };
+    // only queued here, the cache writer commits it later
+    waveform_db_write (key, wavedata->data, wavedata->data_len * sizeof (short), wavedata->channels, CONFIG_CACHE_COMPRESSION, &fingerprint, &info);
+    if (remember) {
+        waveform_memcache_put (key, wavedata->data, wavedata->data_len, wavedata->channels, NULL, &fingerprint);
+    }
+    waveform_evictor_start ();
+    if (key) {
+        free (key);
+        key = NULL;
     }
 }
 
@@ -790,124 +1471,1141 @@ waveform_valid_track (DB_playItem_t *it, const char *uri)
         deadbeef->pl_unlock ();
         return 0;
     }
-    deadbeef->pl_unlock ();
-    return 1;
-}
+    deadbeef->pl_unlock ();
+    return 1;
+}
+
+static int
+waveform_is_cached (DB_playItem_t *it, const char *uri)
+{
+    char *key = waveform_format_uri (it, uri);
+    if (!key) {
+        return 0;
+    }
+    waveform_fingerprint_t stored;
+    int result = waveform_memcache_fingerprint (key, &stored);
+    if (!result) {
+        waveform_db_info_t info;
+        result = waveform_db_fingerprint (key, &stored) && waveform_db_info (key, &info);
+        if (result && info.samples > 0 && info.samples != CONFIG_NUM_SAMPLES) {
+            // analysed at another resolution, the new analysis replaces it
+            trace ("waveform: cached waveform of %s has %d samples\n", uri, info.samples);
+            result = 0;
+        }
+    }
+    if (result) {
+        result = waveform_fingerprint_validate (it, uri, key, &stored);
+    }
+    if (key) {
+        free (key);
+        key = NULL;
+    }
+    return result;
+}
+
+static void
+waveform_get_from_cache (gpointer user_data, DB_playItem_t *it, const char *uri)
+{
+    waveform_t *w = user_data;
+    char *key = waveform_format_uri (it, uri);
+    if (!key) {
+        return;
+    }
+    deadbeef->mutex_lock (w->mutex);
+    // a memory hit brings its pyramid along
+    w->wave->data_len = waveform_memcache_get (key, w->wave->data, w->max_buffer_len, &w->wave->channels, w->wave->pyramid);
+    if (w->wave->data_len == 0) {
+        w->wave->data_len = waveform_db_read (key, w->wave->data, w->max_buffer_len, &w->wave->channels);
+        waveform_wave_changed (w);
+        waveform_fingerprint_t fingerprint;
+        waveform_db_fingerprint (key, &fingerprint);
+        waveform_memcache_put (key, w->wave->data, w->wave->data_len, w->wave->channels, w->wave->pyramid, &fingerprint);
+    }
+    deadbeef->mutex_unlock (w->mutex);
+    if (key) {
+        free (key);
+        key = NULL;
+    }
+}
+
+static void
+waveform_job_free (void *ctx)
+{
+    waveform_job_t *job = ctx;
+    if (job->it) {
+        deadbeef->pl_item_unref (job->it);
+        job->it = NULL;
+    }
+    free (job);
+}
+
+// Shows wavedata in the widget if it belongs to the playing track, which
+// is how cache fills that were running when their track started get drawn.
+static void
+waveform_show_if_playing (waveform_t *w, DB_playItem_t *it, const wavedata_t *wavedata)
+{
+    DB_playItem_t *playing = deadbeef->streamer_get_playing_track ();
+    if (playing && it == playing && wavedata->data_len <= w->max_buffer_len) {
+        deadbeef->mutex_lock (w->mutex);
+        memcpy (w->wave->data, wavedata->data, wavedata->data_len * sizeof (short));
+        w->wave->data_len = wavedata->data_len;
+        w->wave->channels = wavedata->channels;
+        waveform_wave_changed (w);
+        deadbeef->mutex_unlock (w->mutex);
+        g_idle_add (waveform_redraw_cb, w);
+    }
+    if (playing) {
+        deadbeef->pl_item_unref (playing);
+    }
+}
+
+typedef struct
+{
+    DB_playItem_t *it;
+    // frames [start, end) of the image
+    int64_t start;
+    int64_t end;
+    int samples_per_buf;
+    int num_slots;
+    int slot;
+    int slot_frames;
+    float min[MAX_CHANNELS];
+    float max[MAX_CHANNELS];
+    float sum_sq[MAX_CHANNELS];
+    wavedata_t wavedata;
+} waveform_subtrack_t;
+
+static int
+waveform_subtrack_cmp (const void *a, const void *b)
+{
+    const waveform_subtrack_t *x = a;
+    const waveform_subtrack_t *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// Collects the subtracks of the image uri from all playlists, each start
+// only once. Returns their number.
+static int
+waveform_image_subtracks (const char *uri, waveform_subtrack_t *subtracks)
+{
+    int n = 0;
+    deadbeef->pl_lock ();
+    for (int i = 0; i < deadbeef->plt_get_count (); i++) {
+        ddb_playlist_t *plt = deadbeef->plt_get_for_idx (i);
+        if (!plt) {
+            continue;
+        }
+        DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_MAIN);
+        while (it) {
+            const char *it_uri = deadbeef->pl_find_meta_raw (it, ":URI");
+            if (n < IMAGE_MAX_SUBTRACKS
+                && (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK)
+                && it_uri && !strcmp (it_uri, uri)) {
+                int known = 0;
+                for (int j = 0; j < n && !known; j++) {
+                    known = subtracks[j].start == it->startsample;
+                }
+                if (!known) {
+                    deadbeef->pl_item_ref (it);
+                    subtracks[n].it = it;
+                    subtracks[n].start = it->startsample;
+                    n++;
+                }
+            }
+            DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            deadbeef->pl_item_unref (it);
+            it = next;
+        }
+        deadbeef->plt_unref (plt);
+    }
+    deadbeef->pl_unlock ();
+    return n;
+}
+
+// Call once a slot of s is complete or at the end of the image.
+static void
+waveform_subtrack_flush (waveform_subtrack_t *s, int channels)
+{
+    if (s->slot_frames == 0 || s->slot >= s->num_slots) {
+        return;
+    }
+    short *out = s->wavedata.data + s->slot * channels * VALUES_PER_SAMPLE;
+    for (int ch = 0; ch < channels; ch++) {
+        *out++ = (short)(s->max[ch] * 1000);
+        *out++ = (short)(s->min[ch] * 1000);
+        *out++ = (short)(sqrtf (s->sum_sq[ch] / s->slot_frames) * 1000);
+    }
+    s->slot++;
+    s->slot_frames = 0;
+}
+
+// Reduces the part of the block of frames at image position pos which
+// belongs to s into its slots.
+static void
+waveform_subtrack_feed (waveform_subtrack_t *s, waveform_ingest_t *ingest, const char *buffer, int64_t pos, int frames)
+{
+    const int channels = ingest->fmt.channels;
+    int64_t from = MAX (pos, s->start);
+    const int64_t to = MIN (pos + frames, s->end);
+    while (from < to) {
+        const int n = (int)MIN (to - from, s->samples_per_buf - s->slot_frames);
+        float min[MAX_CHANNELS];
+        float max[MAX_CHANNELS];
+        float sum_sq[MAX_CHANNELS];
+        waveform_ingest_reduce (ingest, buffer + (from - pos) * ingest->samplesize, n, min, max, sum_sq);
+        for (int ch = 0; ch < channels; ch++) {
+            if (s->slot_frames == 0) {
+                s->min[ch] = min[ch];
+                s->max[ch] = max[ch];
+                s->sum_sq[ch] = sum_sq[ch];
+            }
+            else {
+                s->min[ch] = MIN (s->min[ch], min[ch]);
+                s->max[ch] = MAX (s->max[ch], max[ch]);
+                s->sum_sq[ch] += sum_sq[ch];
+            }
+        }
+        s->slot_frames += n;
+        from += n;
+        if (s->slot_frames == s->samples_per_buf) {
+            waveform_subtrack_flush (s, channels);
+        }
+    }
+}
+
+// Analyses all uncached subtracks of the image uri in a single decoder pass
+// over the image and caches them. Returns 1 if the job's track is among them
+// and got cached.
+static int
+waveform_generate_image (waveform_job_t *job, const char *uri)
+{
+    int result = 0;
+    int num = 0;
+    DB_playItem_t *image = NULL;
+    DB_fileinfo_t *fileinfo = NULL;
+    char *buffer = NULL;
+    waveform_ingest_t ingest = { .data = NULL };
+
+    DB_decoder_t *dec = waveform_decoder_find (job->it);
+    waveform_subtrack_t *subtracks = calloc (IMAGE_MAX_SUBTRACKS, sizeof (waveform_subtrack_t));
+    if (!dec || !dec->open || !subtracks) {
+        goto out;
+    }
+    const int found = waveform_image_subtracks (uri, subtracks);
+    for (int i = 0; i < found; i++) {
+        if (waveform_is_cached (subtracks[i].it, uri)) {
+            deadbeef->pl_item_unref (subtracks[i].it);
+        }
+        else {
+            subtracks[num++] = subtracks[i];
+        }
+    }
+    if (num == 0) {
+        goto out;
+    }
+    qsort (subtracks, num, sizeof (waveform_subtrack_t), waveform_subtrack_cmp);
+
+    image = deadbeef->pl_item_alloc_init (uri, dec->plugin.id);
+    fileinfo = image ? dec->open (0) : NULL;
+    if (!fileinfo || dec->init (fileinfo, image) != 0) {
+        trace ("waveform: failed to open image %s\n", uri);
+        goto out;
+    }
+    const int channels = fileinfo->fmt.channels;
+    const int samplerate = fileinfo->fmt.samplerate;
+    if (channels <= 0 || channels > MAX_CHANNELS || samplerate <= 0) {
+        goto out;
+    }
+    const int samplesize = channels * (fileinfo->fmt.bps / 8);
+    const int buffer_len = IMAGE_READ_FRAMES * samplesize;
+
+    // same slot layout as the analysis of a single subtrack
+    for (int i = 0; i < num; i++) {
+        waveform_subtrack_t *s = &subtracks[i];
+        const int nsamples = floorf (deadbeef->pl_get_item_duration (s->it) * (float)samplerate);
+        s->samples_per_buf = MAX (1, (int)ceilf ((float)nsamples / (float)CONFIG_NUM_SAMPLES));
+        s->num_slots = (nsamples + s->samples_per_buf - 1) / s->samples_per_buf;
+        s->end = s->start + nsamples;
+        s->wavedata.channels = channels;
+        s->wavedata.data = calloc (MAX (1, s->num_slots) * channels * VALUES_PER_SAMPLE, sizeof (short));
+        if (!s->wavedata.data) {
+            trace ("waveform: out of memory.\n");
+            goto out;
+        }
+    }
+
+    buffer = malloc (buffer_len);
+    if (!buffer || !waveform_ingest_init (&ingest, &fileinfo->fmt, IMAGE_READ_FRAMES)) {
+        trace ("waveform: out of memory.\n");
+        goto out;
+    }
+
+    int64_t pos = 0;
+    int first = 0;
+    while (first < num) {
+        if (waveform_job_cancelled (job)) {
+            goto out;
+        }
+        // jump over cached subtracks, decoders which can't do that
+        // accurately just read through them
+        const int64_t next_start = subtracks[first].start;
+        if (next_start - pos > IMAGE_READ_FRAMES && dec->seek_sample
+            && dec->seek_sample (fileinfo, (int)next_start) == 0) {
+            const float expected_pos = next_start / (float)samplerate;
+            if (fabsf (fileinfo->readpos - expected_pos) > CHUNK_SEEK_TOLERANCE) {
+                trace ("waveform: inaccurate seek in image (%f != %f)\n", fileinfo->readpos, expected_pos);
+                goto out;
+            }
+            pos = next_start;
+        }
+
+        const int sz = dec->read (fileinfo, buffer, buffer_len);
+        if (sz <= 0) {
+            break;
+        }
+        const int frames = sz / samplesize;
+        for (int i = first; i < num && subtracks[i].start < pos + frames; i++) {
+            waveform_subtrack_feed (&subtracks[i], &ingest, buffer, pos, frames);
+        }
+        pos += frames;
+        while (first < num && subtracks[first].end <= pos) {
+            first++;
+        }
+        if (sz < buffer_len) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < num; i++) {
+        waveform_subtrack_t *s = &subtracks[i];
+        waveform_subtrack_flush (s, channels);
+        if (s->slot == 0) {
+            continue;
+        }
+        s->wavedata.data_len = s->slot * channels * VALUES_PER_SAMPLE;
+        s->wavedata.fname = strdup (uri);
+        if (s->wavedata.fname) {
+            waveform_db_cache (job->w, s->it, &s->wavedata, 0);
+            waveform_show_if_playing (job->w, s->it, &s->wavedata);
+            result |= s->it == job->it;
+        }
+    }
+
+out:
+    waveform_ingest_free (&ingest);
+    if (buffer) {
+        free (buffer);
+        buffer = NULL;
+    }
+    if (fileinfo) {
+        dec->free (fileinfo);
+        fileinfo = NULL;
+    }
+    if (image) {
+        deadbeef->pl_item_unref (image);
+        image = NULL;
+    }
+    if (subtracks) {
+        for (int i = 0; i < num; i++) {
+            deadbeef->pl_item_unref (subtracks[i].it);
+            free (subtracks[i].wavedata.data);
+            free (subtracks[i].wavedata.fname);
+        }
+        free (subtracks);
+        subtracks = NULL;
+    }
+    return result;
+}
+
+static void
+waveform_image_job (void *ctx)
+{
+    waveform_job_t *job = ctx;
+    deadbeef->pl_lock ();
+    const char *uri_meta = deadbeef->pl_find_meta_raw (job->it, ":URI");
+    char *uri = uri_meta ? strdup (uri_meta) : NULL;
+    deadbeef->pl_unlock ();
+    // one pass per image, subtrack jobs are queued under their own keys
+    gchar *key = uri ? g_strdup_printf ("image:%s", uri) : NULL;
+    if (key && queue_add (key)) {
+        deadbeef->background_job_increment ();
+        waveform_generate_image (job, uri);
+        queue_pop (key);
+        deadbeef->background_job_decrement ();
+    }
+    g_free (key);
+    free (uri);
+    waveform_job_free (job);
+}
+
+// Fills the cache for the remaining subtracks of the image of it.
+static void
+waveform_image_queue (waveform_t *w, DB_playItem_t *it)
+{
+    waveform_job_t *job = malloc (sizeof (waveform_job_t));
+    if (!job) {
+        return;
+    }
+    deadbeef->pl_item_ref (it);
+    job->w = w;
+    job->it = it;
+    job->generation = JOB_GENERATION_NONE;
+    job->cache_only = 1;
+    job->view_generation = JOB_GENERATION_NONE;
+
+    if (!worker_pool_push (waveform_image_job, waveform_job_free, job, w, WORKER_PRIORITY_BACKGROUND)) {
+        waveform_job_free (job);
+    }
+}
+
+// Analyses the job's track on its own and caches it. Returns 0 if the
+// analysis was aborted.
+static int
+waveform_analyse (waveform_job_t *job, const char *uri)
+{
+    waveform_t *w = job->w;
+    DB_playItem_t *it = job->it;
+    wavedata_t *wavedata = malloc (sizeof (wavedata_t));
+    wavedata->data = malloc (sizeof (short) * w->max_buffer_len);
+    memset (wavedata->data, 0, sizeof (short) * w->max_buffer_len);
+    wavedata->fname = NULL;
+
+    const gboolean complete = waveform_generate_wavedata (job, uri, wavedata);
+    if (complete && CONFIG_CACHE_ENABLED) {
+        waveform_db_cache (w, it, wavedata, !job->cache_only);
+    }
+    if (complete) {
+        waveform_show_if_playing (w, it, wavedata);
+    }
+
+    if (wavedata->data) {
+        free (wavedata->data);
+        wavedata->data = NULL;
+    }
+    if (wavedata->fname) {
+        free (wavedata->fname);
+        wavedata->fname = NULL;
+    }
+    if (wavedata) {
+        free (wavedata);
+        wavedata = NULL;
+    }
+    return complete;
+}
+
+static void
+waveform_get_wavedata (gpointer user_data)
+{
+    waveform_job_t *job = user_data;
+    waveform_t *w = job->w;
+    DB_playItem_t *it = job->it;
+
+    deadbeef->pl_lock ();
+    const char *uri_meta = deadbeef->pl_find_meta_raw (it, ":URI");
+    char *uri = uri_meta ? strdup (uri_meta) : NULL;
+    deadbeef->pl_unlock ();
+    if (!uri) {
+        waveform_job_free (job);
+        return;
+    }
+    if (!waveform_valid_track (it, uri) || waveform_job_cancelled (job)) {
+        free (uri);
+        waveform_job_free (job);
+        return;
+    }
+
+    // subtracks of an image share its uri
+    char *key = waveform_format_uri (it, uri);
+    deadbeef->background_job_increment ();
+    if (CONFIG_CACHE_ENABLED && waveform_is_cached (it, uri)) {
+        if (!job->cache_only) {
+            waveform_get_from_cache (w, it, uri);
+            g_idle_add (waveform_redraw_cb, w);
+        }
+    }
+    else if (key && queue_add (key)) {
+        const int shared = CONFIG_CACHE_ENABLED && CONFIG_SHARED_IMAGE_DECODE
+            && (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK);
+        // background cache fills of a subtrack analyse its whole image in
+        // one pass, a prefetch only does its own subtrack so that it can
+        // take over quickly once the subtrack starts playing
+        const int done = shared && job->cache_only && job->generation == JOB_GENERATION_NONE
+            && waveform_generate_image (job, uri);
+        const int complete = done || waveform_analyse (job, uri);
+        queue_pop (key);
+        if (shared && complete && !done) {
+            // the other subtracks follow in the background
+            waveform_image_queue (w, it);
+        }
+    }
+
+    free (key);
+    free (uri);
+    uri = NULL;
+
+    waveform_job_free (job);
+    deadbeef->background_job_decrement ();
+}
+
+static void
+waveform_job_queue (waveform_t *w, DB_playItem_t *it, int priority)
+{
+    waveform_job_t *job = malloc (sizeof (waveform_job_t));
+    if (!job) {
+        return;
+    }
+    deadbeef->pl_item_ref (it);
+    job->w = w;
+    job->it = it;
+    job->generation = priority == WORKER_PRIORITY_BACKGROUND ? JOB_GENERATION_NONE : w->job_generation;
+    job->cache_only = priority != WORKER_PRIORITY_PLAYING;
+    job->view_generation = JOB_GENERATION_NONE;
+
+    if (!worker_pool_push (waveform_get_wavedata, waveform_job_free, job, job->w, priority)) {
+        waveform_job_free (job);
+    }
+}
+
+// Queues cache fills for the tracks following it. This is only done for
+// linear playback, other orders can't be predicted.
+static void
+waveform_prefetch_upcoming (waveform_t *w, DB_playItem_t *it)
+{
+    if (!CONFIG_CACHE_ENABLED || CONFIG_PREFETCH_TRACKS <= 0) {
+        return;
+    }
+    const int order = deadbeef->conf_get_int ("playback.order", PLAYBACK_ORDER_LINEAR);
+    const int loop = deadbeef->conf_get_int ("playback.loop", PLAYBACK_MODE_LOOP_ALL);
+    if (order != PLAYBACK_ORDER_LINEAR || loop == PLAYBACK_MODE_LOOP_SINGLE) {
+        return;
+    }
+
+    deadbeef->pl_lock ();
+    DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+    if (!next && loop == PLAYBACK_MODE_LOOP_ALL) {
+        // the playing track need not be in the selected playlist
+        ddb_playlist_t *plt = deadbeef->pl_get_playlist (it);
+        if (plt) {
+            next = deadbeef->plt_get_first (plt, PL_MAIN);
+            deadbeef->plt_unref (plt);
+        }
+    }
+    for (int i = 0; next && next != it && i < CONFIG_PREFETCH_TRACKS; i++) {
+        waveform_job_queue (w, next, WORKER_PRIORITY_UPCOMING);
+        DB_playItem_t *after = deadbeef->pl_get_next (next, PL_MAIN);
+        deadbeef->pl_item_unref (next);
+        next = after;
+    }
+    if (next) {
+        deadbeef->pl_item_unref (next);
+    }
+    deadbeef->pl_unlock ();
+}
+
+// Cancels whatever is running for the previous track and starts analysing
+// the currently playing one.
+static void
+waveform_job_start (waveform_t *w)
+{
+    DB_playItem_t *it = deadbeef->streamer_get_playing_track ();
+    deadbeef->mutex_lock (w->mutex);
+    if (w->job_track) {
+        deadbeef->pl_item_unref (w->job_track);
+    }
+    w->job_track = it;
+    if (it) {
+        deadbeef->pl_item_ref (it);
+    }
+    w->job_generation++;
+    deadbeef->mutex_unlock (w->mutex);
+
+    if (!it) {
+        return;
+    }
+    waveform_job_queue (w, it, WORKER_PRIORITY_PLAYING);
+    waveform_prefetch_upcoming (w, it);
+    deadbeef->pl_item_unref (it);
+}
+
+typedef struct
+{
+    waveform_job_t job;
+    float start;
+    float end;
+    int num_slots;
+} waveform_detail_job_t;
+
+static void
+waveform_detail_job_free (void *ctx)
+{
+    waveform_detail_job_t *detail = ctx;
+    waveform_job_free (&detail->job);
+}
+
+// Decodes only the range [start, end] of the job's track by seeking to it.
+// Slot i of wavedata starts at frame *frame_start + i * *samples_per_buf.
+// Returns 0 on failure.
+static int
+waveform_range_decode (waveform_detail_job_t *detail,
+                       wavedata_t *wavedata,
+                       ddb_waveformat_t *fmt,
+                       int *frame_start,
+                       int *samples_per_buf)
+{
+    waveform_job_t *job = &detail->job;
+    DB_decoder_t *dec = waveform_decoder_find (job->it);
+    if (!dec || !dec->open || !dec->seek_sample || waveform_job_cancelled (job)) {
+        return 0;
+    }
+
+    DB_fileinfo_t *fileinfo = dec->open (0);
+    if (!fileinfo) {
+        return 0;
+    }
+    if (dec->init (fileinfo, DB_PLAYITEM (job->it)) != 0) {
+        dec->free (fileinfo);
+        return 0;
+    }
+    *fmt = fileinfo->fmt;
+    dec->free (fileinfo);
+    fileinfo = NULL;
+    if (fmt->channels <= 0 || fmt->channels > MAX_CHANNELS) {
+        return 0;
+    }
+
+    *frame_start = floorf (detail->start * fmt->samplerate);
+    const int frame_end = ceilf (detail->end * fmt->samplerate);
+    *samples_per_buf = MAX (1, (frame_end - *frame_start + detail->num_slots - 1) / detail->num_slots);
+    const int num_slots = (frame_end - *frame_start + *samples_per_buf - 1) / *samples_per_buf;
+
+    wavedata->channels = fmt->channels;
+    wavedata->data_len = num_slots * fmt->channels * VALUES_PER_SAMPLE;
+    wavedata->data = calloc (wavedata->data_len, sizeof (short));
+    if (!wavedata->data) {
+        return 0;
+    }
+
+    waveform_chunk_t chunk = {
+        .job = job,
+        .dec = dec,
+        .wavedata = wavedata,
+        .fmt = *fmt,
+        .samples_per_buf = *samples_per_buf,
+        .frame_offset = *frame_start,
+        .slot_start = 0,
+        .slot_end = num_slots,
+    };
+    waveform_chunk_decode (&chunk);
+    return !chunk.failed;
+}
+
+static char *
+waveform_job_key (waveform_job_t *job)
+{
+    deadbeef->pl_lock ();
+    const char *uri_meta = deadbeef->pl_find_meta_raw (job->it, ":URI");
+    char *uri = uri_meta ? strdup (uri_meta) : NULL;
+    deadbeef->pl_unlock ();
+    char *key = uri ? waveform_format_uri (job->it, uri) : NULL;
+    free (uri);
+    return key;
+}
+
+// Decodes the whole track at DETAIL_LEVEL_SAMPLES slots and stores it as an
+// extra level of its cache entry, so that later zooms don't need to decode.
+static void
+waveform_level_build (void *ctx)
+{
+    waveform_detail_job_t *detail = ctx;
+    wavedata_t wavedata = {0};
+    short *stored = NULL;
+    char *key = waveform_job_key (&detail->job);
+    if (!key || !CONFIG_CACHE_ENABLED) {
+        goto out;
+    }
+    // requested before, in an earlier session maybe
+    stored = malloc (sizeof (short) * DETAIL_BUFFER_LEN);
+    int channels = 0;
+    waveform_db_info_t info;
+    if (!stored || waveform_db_level_read (key, DETAIL_LEVEL_SAMPLES, stored, DETAIL_BUFFER_LEN, &channels, &info) > 0) {
+        goto out;
+    }
+
+    ddb_waveformat_t fmt;
+    int frame_start, samples_per_buf;
+    if (waveform_range_decode (detail, &wavedata, &fmt, &frame_start, &samples_per_buf)) {
+        info.samples = detail->num_slots;
+        info.samplerate = fmt.samplerate;
+        info.duration = detail->end;
+        waveform_db_level_write (key, wavedata.data, wavedata.data_len * sizeof (short), wavedata.channels, CONFIG_CACHE_COMPRESSION, &info);
+        trace ("waveform: stored zoom level of %s\n", key);
+    }
+
+out:
+    free (key);
+    free (stored);
+    free (wavedata.data);
+    waveform_detail_job_free (detail);
+}
+
+// Queues building the zoom level of the job's track once per track.
+static void
+waveform_level_request (waveform_detail_job_t *detail)
+{
+    waveform_t *w = detail->job.w;
+    DB_playItem_t *it = detail->job.it;
+    const float duration = deadbeef->pl_get_item_duration (it);
+    // without level storage the decode would be thrown away
+    if (!CONFIG_CACHE_ENABLED || duration <= 0 || !waveform_db_levels_supported ()) {
+        return;
+    }
+    deadbeef->mutex_lock (w->mutex);
+    const int requested = w->level_track == it;
+    if (!requested) {
+        if (w->level_track) {
+            deadbeef->pl_item_unref (w->level_track);
+        }
+        deadbeef->pl_item_ref (it);
+        w->level_track = it;
+    }
+    deadbeef->mutex_unlock (w->mutex);
+    if (requested) {
+        return;
+    }
 
-static int
-waveform_delete (DB_playItem_t *it, const char *uri)
-{
-    char *key = waveform_format_uri (it, uri);
-    if (!key) {
-        return 0;
+    waveform_detail_job_t *level = malloc (sizeof (waveform_detail_job_t));
+    if (!level) {
+        return;
     }
-    int result = waveform_db_delete (key);
-    if (key) {
-        free (key);
-        key = NULL;
+    deadbeef->pl_item_ref (it);
+    level->job.w = w;
+    level->job.it = it;
+    level->job.generation = JOB_GENERATION_NONE;
+    level->job.cache_only = 1;
+    level->job.view_generation = JOB_GENERATION_NONE;
+    level->start = 0.f;
+    level->end = duration;
+    level->num_slots = DETAIL_LEVEL_SAMPLES;
+    if (!worker_pool_push (waveform_level_build, waveform_detail_job_free, level, w, WORKER_PRIORITY_BACKGROUND)) {
+        waveform_detail_job_free (level);
     }
-    return result;
 }
 
+// Serves the range of the job from the stored zoom level if it resolves it
+// finely enough. Returns 1 if it did.
 static int
-waveform_is_cached (DB_playItem_t *it, const char *uri)
+waveform_detail_from_level (waveform_detail_job_t *detail)
 {
-    char *key = waveform_format_uri (it, uri);
-    if (!key) {
+    waveform_job_t *job = &detail->job;
+    waveform_t *w = job->w;
+    const float duration = deadbeef->pl_get_item_duration (job->it);
+    if (!CONFIG_CACHE_ENABLED || duration <= 0) {
         return 0;
     }
-    int result = waveform_db_cached (key);
-    if (key) {
+    char *key = waveform_job_key (job);
+    short *buffer = key ? malloc (sizeof (short) * DETAIL_BUFFER_LEN) : NULL;
+    if (!buffer) {
         free (key);
-        key = NULL;
+        return 0;
+    }
+
+    int result = 0;
+    int channels = 0;
+    waveform_db_info_t info;
+    const int min_samples = ceilf (detail->num_slots * duration / (detail->end - detail->start));
+    const int n = waveform_db_level_read (key, min_samples, buffer, DETAIL_BUFFER_LEN, &channels, &info);
+    if (n > 0 && channels > 0 && channels <= MAX_CHANNELS && info.samples > 0 && info.samplerate > 0) {
+        // same slot layout as waveform_range_decode over the whole track
+        const int frames = ceilf (info.duration * info.samplerate);
+        const int samples_per_buf = MAX (1, (frames + info.samples - 1) / info.samples);
+        const float slot_time = samples_per_buf / (float)info.samplerate;
+        const int sample_size = channels * VALUES_PER_SAMPLE;
+        const int num_slots = n / sample_size;
+        const int first = MAX (0, (int)floorf (detail->start / slot_time));
+        const int last = MIN (num_slots, (int)ceilf (detail->end / slot_time));
+        if (last > first) {
+            deadbeef->mutex_lock (w->mutex);
+            if (!waveform_job_cancelled (job)) {
+                memcpy (w->detail->data, buffer + first * sample_size, (last - first) * sample_size * sizeof (short));
+                w->detail->data_len = (last - first) * sample_size;
+                w->detail->channels = channels;
+                w->detail_start = first * slot_time;
+                w->detail_end = last * slot_time;
+                waveform_pyramid_build (w->detail->pyramid, w->detail->data, w->detail->data_len, w->detail->channels);
+                g_idle_add (waveform_redraw_cb, w);
+            }
+            deadbeef->mutex_unlock (w->mutex);
+            result = 1;
+        }
     }
+    free (buffer);
+    free (key);
     return result;
 }
 
+// Publishes the range [start, end] of the playing track as detail of the
+// visible range, from the stored zoom level or by decoding it.
 static void
-waveform_get_from_cache (gpointer user_data, DB_playItem_t *it, const char *uri)
+waveform_detail_decode (void *ctx)
 {
-    waveform_t *w = user_data;
-    char *key = waveform_format_uri (it, uri);
-    if (!key) {
-        return;
+    waveform_detail_job_t *detail = ctx;
+    waveform_job_t *job = &detail->job;
+    waveform_t *w = job->w;
+    wavedata_t wavedata = {0};
+
+    if (waveform_detail_from_level (detail)) {
+        goto out;
+    }
+    ddb_waveformat_t fmt;
+    int frame_start, samples_per_buf;
+    if (!waveform_range_decode (detail, &wavedata, &fmt, &frame_start, &samples_per_buf)) {
+        goto out;
     }
+    const int num_slots = wavedata.data_len / (wavedata.channels * VALUES_PER_SAMPLE);
+
     deadbeef->mutex_lock (w->mutex);
-    w->wave->data_len = waveform_db_read (key, w->wave->data, w->max_buffer_len, &w->wave->channels);
+    if (!waveform_job_cancelled (job)) {
+        memcpy (w->detail->data, wavedata.data, wavedata.data_len * sizeof (short));
+        w->detail->data_len = wavedata.data_len;
+        w->detail->channels = wavedata.channels;
+        w->detail_start = frame_start / (float)fmt.samplerate;
+        w->detail_end = (frame_start + num_slots * samples_per_buf) / (float)fmt.samplerate;
+        waveform_pyramid_build (w->detail->pyramid, w->detail->data, w->detail->data_len, w->detail->channels);
+        g_idle_add (waveform_redraw_cb, w);
+    }
     deadbeef->mutex_unlock (w->mutex);
-    if (key) {
-        free (key);
-        key = NULL;
+    waveform_level_request (detail);
+
+out:
+    if (wavedata.data) {
+        free (wavedata.data);
+        wavedata.data = NULL;
     }
+    waveform_detail_job_free (detail);
 }
 
+// Queues decoding of the visible range unless the stored waveform or the
+// current detail already resolve it at pixel resolution.
 static void
-waveform_get_wavedata (gpointer user_data)
+waveform_detail_request (waveform_t *w, float duration, int width)
 {
-    waveform_t *w = user_data;
+    if (w->view_end <= 0 || duration <= 0 || width <= 0) {
+        return;
+    }
+    const float view_len = w->view_end - w->view_start;
+    if (CONFIG_NUM_SAMPLES * view_len / duration >= width) {
+        return;
+    }
+    deadbeef->mutex_lock (w->mutex);
+    const int detail_slots = w->detail->channels > 0 ? w->detail->data_len / (w->detail->channels * VALUES_PER_SAMPLE) : 0;
+    const int covered = w->detail->data_len > 0
+        && w->detail_start <= w->view_start
+        && w->detail_end >= w->view_end
+        && detail_slots * view_len / (w->detail_end - w->detail_start) >= width;
+    deadbeef->mutex_unlock (w->mutex);
+    if (covered) {
+        return;
+    }
+
     DB_playItem_t *it = deadbeef->streamer_get_playing_track ();
     if (!it) {
         return;
     }
+    waveform_detail_job_t *detail = malloc (sizeof (waveform_detail_job_t));
+    if (!detail) {
+        deadbeef->pl_item_unref (it);
+        return;
+    }
+    // takes over the reference of the playing track
+    detail->job.w = w;
+    detail->job.it = it;
+    detail->job.generation = w->job_generation;
+    detail->job.cache_only = 0;
+    detail->job.view_generation = w->view_generation;
+    detail->start = w->view_start;
+    detail->end = w->view_end;
+    detail->num_slots = MIN (width * DETAIL_OVERSAMPLING, MAX_SAMPLES);
 
-    char *uri = strdup (deadbeef->pl_find_meta_raw (it, ":URI"));
-    if (!uri) {
+    if (!worker_pool_push (waveform_detail_decode, waveform_detail_job_free, detail, w, WORKER_PRIORITY_PLAYING)) {
+        waveform_detail_job_free (detail);
+    }
+}
+
+// Zooms in or out by one step keeping the time below x in place.
+static void
+waveform_zoom (waveform_t *w, int zoom_in, double x, double width)
+{
+    DB_playItem_t *trk = deadbeef->streamer_get_playing_track ();
+    if (!trk) {
         return;
     }
-    if (!waveform_valid_track (it, uri)) {
+    const float duration = deadbeef->pl_get_item_duration (trk);
+    deadbeef->pl_item_unref (trk);
+    if (duration <= 0 || width <= 0) {
         return;
     }
 
-    deadbeef->background_job_increment ();
-    if (CONFIG_CACHE_ENABLED && waveform_is_cached (it, uri)) {
-        waveform_get_from_cache (w, it, uri);
-        g_idle_add (waveform_redraw_cb, w);
+    float start, end;
+    waveform_view_get (w, duration, &start, &end);
+    const float anchor = waveform_view_time (w, duration, x, width);
+    const float len = zoom_in ? MAX ((end - start) / ZOOM_STEP, MIN (ZOOM_MIN_DURATION, duration))
+                              : (end - start) * ZOOM_STEP;
+    if (len >= duration) {
+        waveform_view_reset (w);
     }
-    else if (queue_add (uri)) {
-        wavedata_t *wavedata = malloc (sizeof (wavedata_t));
-        wavedata->data = malloc (sizeof (short) * w->max_buffer_len);
-        memset (wavedata->data, 0, sizeof (short) * w->max_buffer_len);
-        wavedata->fname = NULL;
+    else {
+        w->view_start = CLAMP (anchor - x / width * len, 0.f, duration - len);
+        w->view_end = w->view_start + len;
+        w->view_generation++;
+        waveform_detail_request (w, duration, width);
+    }
+    g_idle_add (waveform_redraw_cb, w);
+    g_idle_add (ruler_redraw_cb, w);
+}
 
-        waveform_generate_wavedata (w, it, uri, wavedata);
-        if (CONFIG_CACHE_ENABLED) {
-            waveform_db_cache (w, it, wavedata);
-        }
-        queue_pop (uri);
+typedef struct
+{
+    waveform_t *w;
+    int plt_idx;
+    int item_idx;
+    DB_playItem_t *batch[SCAN_BATCH_SIZE];
+    int batch_len;
+    int batch_pos;
+} waveform_scanner_t;
+
+// claimed with a compare-and-swap, the scanner is started from the GUI
+// thread as well as from pool workers
+static int scanner_running = 0;
 
-        DB_playItem_t *playing = deadbeef->streamer_get_playing_track ();
-        if (playing && it && it == playing) {
-            deadbeef->mutex_lock (w->mutex);
-            memcpy (w->wave->data, wavedata->data, wavedata->data_len * sizeof (short));
-            w->wave->data_len = wavedata->data_len;
-            w->wave->channels = wavedata->channels;
-            deadbeef->mutex_unlock (w->mutex);
-            g_idle_add (waveform_redraw_cb, w);
+static void
+waveform_scanner_free (void *ctx)
+{
+    waveform_scanner_t *scanner = ctx;
+    for (int i = scanner->batch_pos; i < scanner->batch_len; i++) {
+        deadbeef->pl_item_unref (scanner->batch[i]);
+    }
+    free (scanner);
+    __sync_lock_release (&scanner_running);
+}
 
-        }
-        if (playing) {
-            deadbeef->pl_item_unref (playing);
-        }
+// Collects the next batch of playlist items, moving on to the following
+// playlist when the current one is exhausted.
+static void
+waveform_scanner_fill_batch (waveform_scanner_t *scanner)
+{
+    scanner->batch_len = 0;
+    scanner->batch_pos = 0;
 
-        if (wavedata->data) {
-            free (wavedata->data);
-            wavedata->data = NULL;
+    deadbeef->pl_lock ();
+    while (scanner->batch_len == 0 && scanner->plt_idx < deadbeef->plt_get_count ()) {
+        ddb_playlist_t *plt = deadbeef->plt_get_for_idx (scanner->plt_idx);
+        DB_playItem_t *it = plt ? deadbeef->plt_get_item_for_idx (plt, scanner->item_idx, PL_MAIN) : NULL;
+        while (it && scanner->batch_len < SCAN_BATCH_SIZE) {
+            scanner->batch[scanner->batch_len++] = it;
+            scanner->item_idx++;
+            it = deadbeef->pl_get_next (it, PL_MAIN);
         }
-        if (wavedata->fname) {
-            free (wavedata->fname);
-            wavedata->fname = NULL;
+        if (it) {
+            deadbeef->pl_item_unref (it);
         }
-        if (wavedata) {
-            free (wavedata);
-            wavedata = NULL;
+        else if (scanner->batch_len < SCAN_BATCH_SIZE) {
+            scanner->plt_idx++;
+            scanner->item_idx = 0;
+        }
+        if (plt) {
+            deadbeef->plt_unref (plt);
         }
     }
+    deadbeef->pl_unlock ();
+}
+
+// Analyses it on the calling worker if it isn't cached yet, taking over the
+// reference. Returns 0 if there was nothing to do.
+static int
+waveform_scan_item (waveform_t *w, DB_playItem_t *it)
+{
+    deadbeef->pl_lock ();
+    const char *uri_meta = deadbeef->pl_find_meta_raw (it, ":URI");
+    char *uri = uri_meta ? strdup (uri_meta) : NULL;
+    deadbeef->pl_unlock ();
 
+    const int needs_scan = uri && waveform_valid_track (it, uri) && !waveform_is_cached (it, uri);
     free (uri);
-    uri = NULL;
+    waveform_job_t *job = needs_scan ? malloc (sizeof (waveform_job_t)) : NULL;
+    if (!job) {
+        deadbeef->pl_item_unref (it);
+        return needs_scan;
+    }
+    job->w = w;
+    job->it = it;
+    job->generation = JOB_GENERATION_NONE;
+    job->cache_only = 1;
+    job->view_generation = JOB_GENERATION_NONE;
+    waveform_get_wavedata (job);
+    return 1;
+}
 
-    deadbeef->pl_item_unref (it);
-    deadbeef->background_job_decrement ();
+static void
+waveform_scanner_step (void *ctx);
+
+// scanner waiting for the system to calm down, only touched on the main
+// thread once set
+static waveform_scanner_t *scanner_delayed = NULL;
+
+static gboolean
+waveform_scanner_resume (gpointer user_data)
+{
+    waveform_scanner_t *scanner = user_data;
+    scanner_delayed = NULL;
+    if (!worker_pool_push (waveform_scanner_step, waveform_scanner_free, scanner, scanner->w, WORKER_PRIORITY_BACKGROUND)) {
+        waveform_scanner_free (scanner);
+    }
+    return FALSE;
+}
+
+// Drops a delayed scan of w, call from the main thread.
+static void
+waveform_scanner_cancel (waveform_t *w)
+{
+    waveform_scanner_t *scanner = scanner_delayed;
+    if (scanner && scanner->w == w && g_source_remove_by_user_data (scanner)) {
+        scanner_delayed = NULL;
+        waveform_scanner_free (scanner);
+    }
+}
+
+// Analyses at most one uncached track per run and then requeues itself, so
+// that upcoming track jobs are never stuck behind a long scan.
+static void
+waveform_scanner_step (void *ctx)
+{
+    waveform_scanner_t *scanner = ctx;
+    if (!CONFIG_IDLE_SCAN || !CONFIG_CACHE_ENABLED || scanner->w->closing || worker_pool_stopping ()) {
+        waveform_scanner_free (scanner);
+        return;
+    }
+
+    double load = 0.0;
+    if (getloadavg (&load, 1) == 1 && load > SCAN_MAX_LOAD * MAX (1, sysconf (_SC_NPROCESSORS_ONLN))) {
+        // retry later without holding on to a worker
+        trace ("waveform: system busy (load %f), delaying scan\n", load);
+        scanner_delayed = scanner;
+        g_timeout_add (SCAN_THROTTLE_MS, waveform_scanner_resume, scanner);
+        return;
+    }
+
+    for (;;) {
+        if (scanner->batch_pos >= scanner->batch_len) {
+            waveform_scanner_fill_batch (scanner);
+            if (scanner->batch_len == 0) {
+                trace ("waveform: library scan finished\n");
+                waveform_scanner_free (scanner);
+                return;
+            }
+        }
+        // takes over the reference of the batch entry
+        if (waveform_scan_item (scanner->w, scanner->batch[scanner->batch_pos++])) {
+            break;
+        }
+    }
+
+    if (!worker_pool_push (waveform_scanner_step, waveform_scanner_free, scanner, scanner->w, WORKER_PRIORITY_BACKGROUND)) {
+        waveform_scanner_free (scanner);
+    }
+}
+
+static void
+waveform_scanner_start (waveform_t *w)
+{
+    if (!__sync_bool_compare_and_swap (&scanner_running, 0, 1)) {
+        return;
+    }
+    waveform_scanner_t *scanner = malloc (sizeof (waveform_scanner_t));
+    if (!scanner) {
+        __sync_lock_release (&scanner_running);
+        return;
+    }
+    memset (scanner, 0, sizeof (waveform_scanner_t));
+    scanner->w = w;
+    if (!worker_pool_push (waveform_scanner_step, waveform_scanner_free, scanner, scanner->w, WORKER_PRIORITY_BACKGROUND)) {
+        waveform_scanner_free (scanner);
+    }
+}
+
+// Tracks picked by the user to be analysed, worked off one per run like
+// the scanner.
+typedef struct
+{
+    waveform_t *w;
+    DB_playItem_t **items;
+    int len;
+    int pos;
+} waveform_generator_t;
+
+static void
+waveform_generator_free (void *ctx)
+{
+    waveform_generator_t *gen = ctx;
+    for (int i = gen->pos; i < gen->len; i++) {
+        deadbeef->pl_item_unref (gen->items[i]);
+    }
+    free (gen->items);
+    free (gen);
+}
+
+static void
+waveform_generator_step (void *ctx)
+{
+    waveform_generator_t *gen = ctx;
+    if (!CONFIG_CACHE_ENABLED || gen->w->closing || worker_pool_stopping ()) {
+        waveform_generator_free (gen);
+        return;
+    }
+    while (gen->pos < gen->len && !waveform_scan_item (gen->w, gen->items[gen->pos++]));
+    if (gen->pos >= gen->len) {
+        waveform_generator_free (gen);
+        return;
+    }
+    if (!worker_pool_push (waveform_generator_step, waveform_generator_free, gen, gen->w, WORKER_PRIORITY_BACKGROUND)) {
+        waveform_generator_free (gen);
+    }
+}
+
+// claimed with a compare-and-swap like scanner_running, every cache write
+// tries to start the evictor
+static int evictor_running = 0;
+
+static void
+waveform_evictor_free (void *ctx)
+{
+    __sync_lock_release (&evictor_running);
+}
+
+// Drops a batch of the least recently used waveforms per run while the
+// cache exceeds its size limit. The cache locks itself, so w->mutex is
+// left alone and drawing never waits for an eviction.
+static void
+waveform_evictor_step (void *ctx)
+{
+    const int64_t max_bytes = (int64_t)CONFIG_CACHE_MAX_SIZE * 1024 * 1024;
+    if (!waveform_db_evict (max_bytes, EVICT_BATCH_SIZE)) {
+        waveform_evictor_free (ctx);
+        return;
+    }
+    if (!worker_pool_push (waveform_evictor_step, waveform_evictor_free, ctx, NULL, WORKER_PRIORITY_BACKGROUND)) {
+        waveform_evictor_free (ctx);
+    }
+}
+
+static void
+waveform_evictor_start (void)
+{
+    if (CONFIG_CACHE_MAX_SIZE <= 0 || !__sync_bool_compare_and_swap (&evictor_running, 0, 1)) {
+        return;
+    }
+    if (!worker_pool_push (waveform_evictor_step, waveform_evictor_free, NULL, NULL, WORKER_PRIORITY_BACKGROUND)) {
+        waveform_evictor_free (NULL);
+    }
 }
 
 static gboolean
@@ -954,7 +2652,9 @@ ruler_expose_event (GtkWidget *widget, GdkEventExpose *event, gpointer user_data
         deadbeef->pl_item_unref (trk);
     }
 
-    waveform_render_ruler (cr, &w->colors, duration, &rect);
+    float view_start, view_end;
+    waveform_view_get (w, duration, &view_start, &view_end);
+    waveform_render_ruler (cr, &w->colors, view_start, view_end - view_start, &rect);
 
     cairo_destroy (cr);
 }
@@ -1044,16 +2744,28 @@ waveform_motion_notify_event (GtkWidget *widget, GdkEventButton *event, gpointer
 static gboolean
 waveform_scroll_event (GtkWidget *widget, GdkEvent *event, gpointer user_data)
 {
+    waveform_t *w = user_data;
     GdkEventScroll *ev = (GdkEventScroll *)event;
+    if (ev->state & GDK_CONTROL_MASK) {
+        GtkAllocation a;
+        gtk_widget_get_allocation (w->drawarea, &a);
+        if (ev->direction == GDK_SCROLL_UP || ev->direction == GDK_SCROLL_DOWN) {
+            waveform_zoom (w, ev->direction == GDK_SCROLL_UP, ev->x, a.width);
+        }
+        return TRUE;
+    }
     if (!CONFIG_SCROLL_ENABLED) {
         return TRUE;
     }
 
     DB_playItem_t *trk = deadbeef->streamer_get_playing_track ();
     if (trk) {
-        const int duration = (int)(deadbeef->pl_get_item_duration (trk) * 1000);
+        const float dur = deadbeef->pl_get_item_duration (trk);
+        float view_start, view_end;
+        waveform_view_get (w, dur, &view_start, &view_end);
+        const int duration = (int)(dur * 1000);
         const int time = (int)(deadbeef->streamer_get_playpos () * 1000);
-        const int step = CLAMP (duration / 30, 1000, 3600000);
+        const int step = CLAMP ((int)((view_end - view_start) * 1000) / 30, 1000, 3600000);
 
         switch (ev->direction) {
             case GDK_SCROLL_UP:
@@ -1107,7 +2819,7 @@ waveform_button_release_event (GtkWidget *widget, GdkEventButton *event, gpointe
         if (trk) {
             GtkAllocation a;
             gtk_widget_get_allocation (w->drawarea, &a);
-            const float time = MAX (0, (event->x - a.x) * deadbeef->pl_get_item_duration (trk) / (a.width) * 1000.f);
+            const float time = MAX (0, waveform_view_time (w, deadbeef->pl_get_item_duration (trk), event->x - a.x, a.width) * 1000.f);
             deadbeef->sendmessage (DB_EV_SEEK, 0, time, 0);
             deadbeef->pl_item_unref (trk);
         }
@@ -1121,26 +2833,32 @@ static int
 waveform_message (ddb_gtkui_widget_t *widget, uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2)
 {
     waveform_t *w = (waveform_t *)widget;
-    intptr_t tid;
 
     switch (id) {
     case DB_EV_SONGSTARTED:
         playback_status = PLAYING;
+        // never draw the previous track's waveform against the new one
+        deadbeef->mutex_lock (w->mutex);
+        w->wave->data_len = 0;
+        w->wave->channels = 0;
+        waveform_wave_changed (w);
+        deadbeef->mutex_unlock (w->mutex);
+        waveform_view_reset (w);
         waveform_set_refresh_interval (w, CONFIG_REFRESH_INTERVAL);
         g_idle_add (waveform_redraw_cb, w);
         g_idle_add (ruler_redraw_cb, w);
-        tid = deadbeef->thread_start_low_priority (waveform_get_wavedata, w);
-        if (tid) {
-            deadbeef->thread_detach (tid);
-        }
+        waveform_job_start (w);
         break;
     case DB_EV_STOP:
         playback_status = STOPPED;
+        w->job_generation++;
         deadbeef->mutex_lock (w->mutex);
         memset (w->wave->data, 0, sizeof (short) * w->max_buffer_len);
         w->wave->data_len = 0;
         w->wave->channels = 0;
+        waveform_wave_changed (w);
         deadbeef->mutex_unlock (w->mutex);
+        waveform_view_reset (w);
         g_idle_add (waveform_redraw_cb, w);
         g_idle_add (ruler_redraw_cb, w);
         break;
@@ -1163,8 +2881,17 @@ static void
 waveform_destroy (ddb_gtkui_widget_t *widget)
 {
     waveform_t *w = (waveform_t *)widget;
+    // jobs hold on to w, make them bail out and wait for them before
+    // anything they may touch is freed
+    w->closing = 1;
+    w->job_generation++;
+    w->view_generation++;
+    worker_pool_cancel (w);
+    waveform_scanner_cancel (w);
+    // redraws queued by the jobs that just finished
+    while (g_idle_remove_by_data (w));
+
     deadbeef->mutex_lock (w->mutex);
-    waveform_db_close ();
     if (w->drawtimer) {
         g_source_remove (w->drawtimer);
         w->drawtimer = 0;
@@ -1189,16 +2916,41 @@ waveform_destroy (ddb_gtkui_widget_t *widget)
         free (w->wave->fname);
         w->wave->fname = NULL;
     }
+    if (w->wave->pyramid) {
+        waveform_pyramid_free (w->wave->pyramid);
+        w->wave->pyramid = NULL;
+    }
     if (w->wave) {
         free (w->wave);
         w->wave = NULL;
     }
+    if (w->detail) {
+        free (w->detail->data);
+        waveform_pyramid_free (w->detail->pyramid);
+        free (w->detail);
+        w->detail = NULL;
+    }
+    if (w->level_track) {
+        deadbeef->pl_item_unref (w->level_track);
+        w->level_track = NULL;
+    }
+    if (w->job_track) {
+        deadbeef->pl_item_unref (w->job_track);
+        w->job_track = NULL;
+    }
+    if (w->render) {
+        waveform_data_render_free (w->render);
+        w->render = NULL;
+    }
     deadbeef->mutex_unlock (w->mutex);
     if (w->mutex) {
         deadbeef->mutex_free (w->mutex);
         w->mutex = 0;
     }
 
+    if (waveform_instance == w) {
+        waveform_instance = NULL;
+    }
     if (waveform_instancecount > 0) {
         waveform_instancecount--;
     }
@@ -1221,6 +2973,11 @@ waveform_init (ddb_gtkui_widget_t *w)
     wf->wave->fname = NULL;
     wf->wave->data_len = 0;
     wf->wave->channels = 0;
+    wf->wave->pyramid = waveform_pyramid_new ();
+    wf->detail = calloc (1, sizeof (wavedata_t));
+    wf->detail->data = malloc (sizeof (short) * DETAIL_BUFFER_LEN);
+    wf->detail->pyramid = waveform_pyramid_new ();
+    wf->render = waveform_data_render_new ();
     wf->surf = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
                                            a.width,
                                            a.height);
@@ -1232,20 +2989,10 @@ waveform_init (ddb_gtkui_widget_t *w)
     wf->height = a.height;
     wf->width = a.width;
 
-    make_cache_dir (cache_path, sizeof (cache_path)/sizeof (char));
-
-    deadbeef->mutex_lock (wf->mutex);
-    waveform_db_open (cache_path);
-    waveform_db_init (NULL);
-    deadbeef->mutex_unlock (wf->mutex);
-
     DB_playItem_t *it = deadbeef->streamer_get_playing_track ();
     if (it) {
         playback_status = PLAYING;
-        intptr_t tid = deadbeef->thread_start_low_priority (waveform_get_wavedata, w);
-        if (tid) {
-            deadbeef->thread_detach (tid);
-        }
+        waveform_job_start (wf);
         deadbeef->pl_item_unref (it);
     }
     wf->resizetimer = 0;
@@ -1311,6 +3058,7 @@ waveform_create (void)
     g_signal_connect_after ((gpointer) w->popup_item, "activate", G_CALLBACK (on_button_config), w);
     gtkui_plugin->w_override_signals (w->base.widget, w);
 
+    waveform_instance = w;
     waveform_instancecount++;
 
     return (ddb_gtkui_widget_t *)w;
@@ -1334,6 +3082,13 @@ static int
 waveform_start (void)
 {
     load_config ();
+    waveform_reduce_init ();
+    waveform_memcache_set_budget ((size_t)MAX (CONFIG_MEMORY_CACHE_SIZE, 0) * 1024 * 1024);
+    make_cache_dir (cache_path, sizeof (cache_path)/sizeof (char));
+    waveform_db_open (cache_path, CONFIG_CACHE_BACKEND);
+    waveform_db_init (NULL);
+    worker_pool_start (CONFIG_ANALYSIS_THREADS);
+    waveform_evictor_start ();
     return 0;
 }
 
@@ -1341,6 +3096,10 @@ static int
 waveform_stop (void)
 {
     save_config ();
+    worker_pool_stop ();
+    // the pool has drained, nothing reads or queues cache writes anymore
+    waveform_db_close ();
+    waveform_memcache_clear ();
     return 0;
 }
 
@@ -1354,42 +3113,143 @@ waveform_disconnect (void)
     return 0;
 }
 
+static void
+waveform_keys_free (char **keys, int num_keys)
+{
+    if (!keys) {
+        return;
+    }
+    for (int i = 0; i < num_keys; i++) {
+        free (keys[i]);
+    }
+    free (keys);
+}
+
+// Collects the cache keys of all selected tracks of the current playlist.
+// Returns NULL and no keys if it runs out of memory.
+static char **
+waveform_selected_keys (int *num_keys)
+{
+    *num_keys = 0;
+    int keys_size = 0;
+    char **keys = NULL;
+    deadbeef->pl_lock ();
+    ddb_playlist_t *plt = deadbeef->plt_get_curr ();
+    if (plt) {
+        DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_MAIN);
+        while (it) {
+            if (deadbeef->pl_is_selected (it)) {
+                if (*num_keys == keys_size) {
+                    keys_size = MAX (64, keys_size * 2);
+                    char **grown = realloc (keys, keys_size * sizeof (char *));
+                    if (!grown) {
+                        deadbeef->pl_item_unref (it);
+                        deadbeef->plt_unref (plt);
+                        deadbeef->pl_unlock ();
+                        waveform_keys_free (keys, *num_keys);
+                        *num_keys = 0;
+                        return NULL;
+                    }
+                    keys = grown;
+                }
+                char *key = waveform_format_uri (it, deadbeef->pl_find_meta_raw (it, ":URI"));
+                if (key) {
+                    keys[(*num_keys)++] = key;
+                }
+            }
+            DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            deadbeef->pl_item_unref (it);
+            it = next;
+        }
+        deadbeef->plt_unref (plt);
+    }
+    deadbeef->pl_unlock ();
+    return keys;
+}
+
 static int
 waveform_action_lookup (DB_plugin_action_t *action, int ctx)
 {
-    DB_playItem_t *it = NULL;
+    if (ctx != DDB_ACTION_CTX_SELECTION) {
+        return 0;
+    }
+    int num_keys = 0;
+    char **keys = waveform_selected_keys (&num_keys);
+    for (int i = 0; i < num_keys; i++) {
+        if (keys[i]) {
+            waveform_memcache_remove (keys[i]);
+        }
+    }
+    waveform_db_delete_batch (keys, num_keys);
+    waveform_keys_free (keys, num_keys);
+    return 0;
+}
+
+static int
+waveform_action_generate (DB_plugin_action_t *action, int ctx)
+{
+    waveform_t *w = waveform_instance;
+    if (!w || !CONFIG_CACHE_ENABLED) {
+        return 0;
+    }
+    if (ctx != DDB_ACTION_CTX_SELECTION && ctx != DDB_ACTION_CTX_PLAYLIST) {
+        return 0;
+    }
+    waveform_generator_t *gen = malloc (sizeof (waveform_generator_t));
+    if (!gen) {
+        return 0;
+    }
+    memset (gen, 0, sizeof (waveform_generator_t));
+    gen->w = w;
+
+    // one job for the whole selection, queued tracks are only referenced
+    int size = 0;
     deadbeef->pl_lock ();
-    if (ctx == DDB_ACTION_CTX_SELECTION) {
-        ddb_playlist_t *plt = deadbeef->plt_get_curr ();
-        if (plt) {
-            it = deadbeef->plt_get_first (plt, PL_MAIN);
-            while (it) {
-                if (deadbeef->pl_is_selected (it)) {
-                    const char *uri = deadbeef->pl_find_meta_raw (it, ":URI");
-                    if (waveform_is_cached (it, uri)) {
-                        waveform_delete (it, uri);
+    ddb_playlist_t *plt = deadbeef->plt_get_curr ();
+    if (plt) {
+        DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_MAIN);
+        while (it) {
+            if (ctx == DDB_ACTION_CTX_PLAYLIST || deadbeef->pl_is_selected (it)) {
+                if (gen->len == size) {
+                    size = size ? size * 2 : SCAN_BATCH_SIZE;
+                    DB_playItem_t **items = realloc (gen->items, size * sizeof (DB_playItem_t *));
+                    if (!items) {
+                        deadbeef->pl_item_unref (it);
+                        break;
                     }
+                    gen->items = items;
                 }
-                DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
-                deadbeef->pl_item_unref (it);
-                it = next;
+                deadbeef->pl_item_ref (it);
+                gen->items[gen->len++] = it;
             }
-            deadbeef->plt_unref (plt);
+            DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            deadbeef->pl_item_unref (it);
+            it = next;
         }
-    }
-    if (it) {
-        deadbeef->pl_item_unref (it);
+        deadbeef->plt_unref (plt);
     }
     deadbeef->pl_unlock ();
+
+    if (gen->len == 0 || !worker_pool_push (waveform_generator_step, waveform_generator_free, gen, w, WORKER_PRIORITY_BACKGROUND)) {
+        waveform_generator_free (gen);
+    }
     return 0;
 }
 
+static DB_plugin_action_t generate_action = {
+    .title = "Generate Waveforms",
+    .name = "waveform_generate",
+    .flags = DB_ACTION_MULTIPLE_TRACKS | DB_ACTION_PLAYLIST | DB_ACTION_ADD_MENU,
+    .callback2 = waveform_action_generate,
+    .next = NULL
+};
+
 static DB_plugin_action_t lookup_action = {
     .title = "Remove Waveform From Cache",
     .name = "waveform_lookup",
     .flags = DB_ACTION_MULTIPLE_TRACKS | DB_ACTION_ADD_MENU,
     .callback2 = waveform_action_lookup,
-    .next = NULL
+    .next = &generate_action
 };
 
 static DB_plugin_action_t *
@@ -1399,19 +3259,23 @@ waveform_get_actions (DB_playItem_t *it)
         return NULL;
     }
     deadbeef->pl_lock ();
-    lookup_action.flags |= DB_ACTION_DISABLED;
-    DB_playItem_t *current = deadbeef->pl_get_first (PL_MAIN);
-    while (current) {
-        if (deadbeef->pl_is_selected (current) && waveform_is_cached (current, deadbeef->pl_find_meta_raw (current, ":URI"))) {
-            lookup_action.flags &= ~DB_ACTION_DISABLED;
-            deadbeef->pl_item_unref (current);
-            break;
-        }
-        DB_playItem_t *next = deadbeef->pl_get_next (current, PL_MAIN);
-        deadbeef->pl_item_unref (current);
-        current = next;
+    if (CONFIG_CACHE_ENABLED) {
+        generate_action.flags &= ~DB_ACTION_DISABLED;
+    }
+    else {
+        generate_action.flags |= DB_ACTION_DISABLED;
     }
     deadbeef->pl_unlock ();
+
+    int num_keys = 0;
+    char **keys = waveform_selected_keys (&num_keys);
+    if (waveform_db_cached_batch (keys, num_keys) > 0) {
+        lookup_action.flags &= ~DB_ACTION_DISABLED;
+    }
+    else {
+        lookup_action.flags |= DB_ACTION_DISABLED;
+    }
+    waveform_keys_free (keys, num_keys);
     return &lookup_action;
 }
 
@@ -1426,6 +3290,23 @@ static const char settings_dlg[] =
     "property \"Use cache \"                        checkbox "                  CONFSTR_WF_CACHE_ENABLED        " 1 ;\n"
     "property \"Scroll wheel to seek \"             checkbox "                  CONFSTR_WF_SCROLL_ENABLED       " 1 ;\n"
     "property \"Number of samples (per channel): \" spinbtn[2048,4092,2048] "   CONFSTR_WF_NUM_SAMPLES       " 2048 ;\n"
+    "property \"Parallel analysis of long files \"  checkbox "                  CONFSTR_WF_PARALLEL_ANALYSIS    " 1 ;\n"
+    "property \"Analyse all tracks of a CUE "
+                "image in one pass \"               checkbox "                  CONFSTR_WF_SHARED_IMAGE_DECODE  " 1 ;\n"
+    "property \"Prefetch upcoming tracks: \"        spinbtn[0,10,1] "           CONFSTR_WF_PREFETCH_TRACKS      " 2 ;\n"
+    "property \"Analyse uncached tracks of all "
+                "playlists when idle \"             checkbox "                  CONFSTR_WF_IDLE_SCAN            " 0 ;\n"
+    "property \"Concurrent analysis jobs "
+                "(requires restart): \"             spinbtn[1,16,1] "           CONFSTR_WF_ANALYSIS_THREADS     " 2 ;\n"
+    "property \"Cache compression: \"               select[3] "                 CONFSTR_WF_CACHE_COMPRESSION    " 1 None Lossless \"Compact (lossy)\" ;\n"
+    "property \"Recognize unchanged audio after "
+                "tag edits \"                       checkbox "                  CONFSTR_WF_CACHE_CONTENT_HASH   " 1 ;\n"
+    "property \"Cache storage "
+                "(requires restart): \"             select[2] "                 CONFSTR_WF_CACHE_BACKEND        " 0 SQLite \"Memory-mapped file\" ;\n"
+    "property \"Maximum cache size in MB "
+                "(0: unlimited): \"                 spinbtn[0,100000,10] "      CONFSTR_WF_CACHE_MAX_SIZE       " 0 ;\n"
+    "property \"Memory cache size in MB "
+                "(0: disabled): \"                  spinbtn[0,1024,1] "         CONFSTR_WF_MEMORY_CACHE_SIZE   " 16 ;\n"
 ;
 
 static DB_misc_t plugin = {
@@ -33,12 +33,16 @@
 
 extern DB_functions_t *deadbeef;
 
+struct waveform_pyramid_s;
+
 typedef struct wavedata_s
 {
     char *fname;
     short *data;
     size_t data_len;
     int channels;
+    // reduction levels over data, rebuilt whenever data changes
+    struct waveform_pyramid_s *pyramid;
 } wavedata_t;
 
 typedef struct color_s